@@ -1,5 +1,6 @@
 create_component(sv-indexer 
 LIB_SRC 
+    PRIVATE indexer/index_arena.cpp
     PRIVATE indexer/index_elements.cpp
     PRIVATE indexer/index_symbols.cpp
     PRIVATE indexer/index_file.cpp
@@ -7,6 +8,7 @@ LIB_SRC
     PRIVATE indexer/index_core.cpp
     PRIVATE indexer/index_visitor.cpp
     PRIVATE indexer/index_reference_visitor.cpp
+    PRIVATE indexer/index_serializer.cpp
 LIB_INC
     PUBLIC indexer/include
 LIB_LINK
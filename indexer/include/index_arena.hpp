@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+
+namespace diplomat::index
+{
+	/**
+	 * @brief Monotonic storage of the scopes, symbols and names of an index.
+	 *
+	 * Memory is only released, all at once, when the arena is destroyed. Objects built by
+	 * #create are therefore never destroyed: their members shall either be trivially
+	 * destructible or allocate from the arena as well (see #resource).
+	 *
+	 * The arena is not thread-safe.
+	 */
+	class IndexArena
+	{
+		std::pmr::monotonic_buffer_resource _resource;
+
+		//! Interned strings, viewing copies allocated from #_resource.
+		std::pmr::unordered_set<std::string_view> _strings;
+
+	public:
+		IndexArena();
+		IndexArena(const IndexArena&) = delete;
+		IndexArena& operator=(const IndexArena&) = delete;
+		~IndexArena() = default;
+
+		inline std::pmr::memory_resource* resource() {return &_resource;};
+
+		/**
+		 * @brief Get the arena copy of a string, shared by all equal strings.
+		 *
+		 * @param str String to intern
+		 * @return std::string_view View valid as long as the arena.
+		 */
+		std::string_view intern(std::string_view str);
+
+		/**
+		 * @brief Build an object in the arena.
+		 * The object will never be destroyed, only its memory released along with the arena.
+		 */
+		template<typename T, typename... Args>
+		T* create(Args&&... args)
+		{
+			std::pmr::polymorphic_allocator<T> alloc(&_resource);
+			return alloc.template new_object<T>(std::forward<Args>(args)...);
+		}
+	};
+}
@@ -1,6 +1,8 @@
 #pragma once 
 
+#include <functional>
 #include <map>
+#include <unordered_map>
 #include <memory>
 #include <string>
 #include <ranges>
@@ -8,6 +10,7 @@
 #include <slang/syntax/SyntaxTree.h>
 #include <slang/text/SourceManager.h>
 
+#include "index_arena.hpp"
 #include "index_elements.hpp"
 #include "index_scope.hpp"
 #include "index_file.hpp"
@@ -22,24 +25,43 @@ namespace diplomat::index
 	{
 
 	friend class IndexScopeVisitor;
+	friend class IndexSerializer;
 	friend void to_json(nlohmann::json& j, const IndexCore& s);
 
 	protected:
-		std::unique_ptr<IndexScope> _root;
+		//! Storage of the scopes and symbols, declared first to be released last.
+		IndexArena _arena;
+		//! Root scope, built in #_arena.
+		IndexScope* _root = nullptr;
 		std::map<std::filesystem::path, std::unique_ptr<IndexFile>> _files;
+		//! Same files as #_files, by file ID for the lookups from locations.
+		std::unordered_map<std::uint32_t, IndexFile*> _files_by_id;
 
 		//void _process_file_reference(slang::SourceManager* sm, const std::filesystem::path& fpath, IndexFile* f);
 	public:
 
-		IndexScope* set_root_scope(const std::string name);
-		inline IndexScope* get_root_scope(){return _root.get();};
+		IndexScope* set_root_scope(std::string_view name);
+		inline IndexScope* get_root_scope(){return _root;};
 
 		IndexFile* add_file(const std::filesystem::path& path);
 		IndexFile* add_file(const std::string_view& path);
 
+		/**
+		 * @brief Get or create an indexed file from its ID, see FileTable
+		 */
+		IndexFile* add_file_by_id(std::uint32_t file_id);
+
 		IndexFile* get_file(const std::filesystem::path& path);
 		const IndexFile* get_file(const std::filesystem::path& path) const;
 
+		/**
+		 * @brief Get an indexed file from its ID, see FileTable
+		 * 
+		 * @return IndexFile* if the file is indexed, nullptr otherwise
+		 */
+		IndexFile* get_file_by_id(std::uint32_t file_id);
+		const IndexFile* get_file_by_id(std::uint32_t file_id) const;
+
 		IndexSymbol* add_symbol(const std::string_view& name, const IndexRange& src_range, const std::string_view& kind = "");
 
 		inline nlohmann::json dump() const {return nlohmann::json(*this);} ;
@@ -54,6 +76,33 @@ namespace diplomat::index
 	   inline auto get_indexed_files_paths() const { return std::views::keys(_files);} ;
 	   inline auto get_indexed_files() const { return std::views::values(_files);} ;
 
+		/**
+		 * @brief Resolve the references of all files from their syntax roots.
+		 * 
+		 * Files are processed in parallel, yet the resulting index does not depend 
+		 * on the number of threads.
+		 * 
+		 * @param sm Source manager of the syntax roots.
+		 * @param threads Number of threads, 0 to use all available cores.
+		 * @param cancelled Optional check, called before processing each file. 
+		 * Once it returns true, no reference is added to the index.
+		 * @return false if cancelled, true otherwise.
+		 */
+		bool process_references(const slang::SourceManager& sm, unsigned int threads = 0, const std::function<bool()>& cancelled = {});
+
+		/**
+		 * @brief Drop the syntax roots of all files, once the references are processed.
+		 * The index does not refer to the slang compilation anymore afterwards.
+		 */
+		void release_syntax();
+
+		/**
+		 * @brief Freeze the references of all files, once the reference pass is done,
+		 * and build their scope lookup tables. The index is then only read.
+		 * @see IndexFile::freeze_references
+		 */
+		void freeze_references();
+
 		IndexScope* get_scope_by_position(const IndexLocation& pos);
 
 		const IndexSymbol* get_symbol_by_position(const IndexLocation& pos) ;
@@ -6,6 +6,7 @@
 #include <filesystem>
 #include <optional>
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
 #include <string_view>
 #include <compare>
@@ -81,16 +82,52 @@ std::size_t hash_combine(size_t lhs, size_t rhs);
 namespace index
 {
 
+	/**
+	 * @brief Process-wide interning table of the indexed file paths.
+	 * 
+	 * Locations only hold the ID of their file, such that they are small, and compared or 
+	 * hashed without touching the paths. Paths are only looked up at the LSP boundary.
+	 * 
+	 * Paths are canonicalized once per distinct spelling. IDs are never released, as the number
+	 * of files seen by a process is bounded by the workspace. The ID 0 stands for the empty path.
+	 * 
+	 * All the methods are thread-safe.
+	 */
+	class FileTable
+	{
+	public:
+		/**
+		 * @brief Get the ID of a file, allocating it on the first call.
+		 * 
+		 * @param path Path of the file, canonicalized (weakly) before interning.
+		 * @return std::uint32_t ID of the canonical path.
+		 */
+		static std::uint32_t get_id(const std::filesystem::path& path);
+
+		/**
+		 * @brief Get the canonical path of a file from its ID.
+		 * The reference is valid for the whole life of the process.
+		 */
+		static const std::filesystem::path& get_path(std::uint32_t id);
+	};
+
+	/**
+	 * @brief Location in a file, with 1-based line and column.
+	 */
 	struct IndexLocation
 	{
-		std::size_t line;
-		std::size_t column;
-		std::filesystem::path file;
+		std::uint32_t line;
+		std::uint32_t column;
+		//! Interned file path, see FileTable
+		std::uint32_t file_id;
 
 		IndexLocation(); // Required for easy JSON serialization
 		IndexLocation(const std::filesystem::path& file, std::size_t line, std::size_t column);
+		IndexLocation(std::uint32_t file_id, std::size_t line, std::size_t column);
 		explicit IndexLocation(const slang::SourceLocation& loc, const slang::SourceManager& sm);
 
+		inline const std::filesystem::path& file() const {return FileTable::get_path(file_id);};
+
 		bool operator==(const IndexLocation& rhs) const;
 		std::strong_ordering operator<=>(const IndexLocation& rhs) const;
 
@@ -110,8 +147,8 @@ namespace index
 		IndexRange(const IndexLocation& base, std::size_t nchars, std::size_t nlines = 0);
 		
 
-		bool contains(const IndexLocation& loc);
-		bool contains(const IndexRange& loc);
+		bool contains(const IndexLocation& loc) const;
+		bool contains(const IndexRange& loc) const;
 
 		bool operator==(const IndexRange& rhs) const;
 	};
@@ -143,10 +180,9 @@ struct std::hash<diplomat::index::IndexLocation>
 {
 	std::size_t operator()(const diplomat::index::IndexLocation& s) const noexcept
 	{
-	   std::size_t ret = 0;
-	   diplomat::hash_combine(ret,std::hash<std::filesystem::path>{}(s.file));
-	   diplomat::hash_combine(ret,std::hash<size_t>{}(s.line));
-	   diplomat::hash_combine(ret,std::hash<size_t>{}(s.column));
+	   std::size_t ret = std::hash<std::uint32_t>{}(s.file_id);
+	   ret = diplomat::hash_combine(ret,std::hash<std::uint32_t>{}(s.line));
+	   ret = diplomat::hash_combine(ret,std::hash<std::uint32_t>{}(s.column));
 	   return ret;
 	}
 };
@@ -158,9 +194,8 @@ struct std::hash<diplomat::index::IndexRange>
 {
 	std::size_t operator()(const diplomat::index::IndexRange& s) const noexcept
 	{
-	   std::size_t ret = 0;
-	   diplomat::hash_combine(ret,std::hash<diplomat::index::IndexLocation>{}(s.start));
-	   diplomat::hash_combine(ret,std::hash<diplomat::index::IndexLocation>{}(s.end));
+	   std::size_t ret = std::hash<diplomat::index::IndexLocation>{}(s.start);
+	   ret = diplomat::hash_combine(ret,std::hash<diplomat::index::IndexLocation>{}(s.end));
 	   return ret;
 	}
 };
\ No newline at end of file
@@ -7,7 +7,9 @@
 #include <unordered_map>
 #include <vector>
 #include <memory>
+#include <memory_resource>
 #include <ranges>
+#include <limits>
 
 #include <slang/syntax/SyntaxNode.h>
 namespace diplomat::index      
@@ -25,19 +27,60 @@ namespace diplomat::index
     {
 
         friend void to_json(nlohmann::json& j, const IndexFile& s);
+        friend class IndexSerializer;
     protected:
         std::filesystem::path _filepath;
+        //! Interned #_filepath, see FileTable
+        std::uint32_t _file_id;
 
         // This may contain the syntax tree used to define the file
         std::optional<const slang::syntax::SyntaxNode*> _syntax_root; 
 
         // Used for fast lookup of scopes
         std::unordered_map<std::string, IndexScope*> _scopes;
-        std::unordered_map<IndexRange, std::unique_ptr<IndexSymbol>> _declarations;
+
+        /**
+         * @brief Source range of a scope of the file, along with the innermost scope that includes it.
+         */
+        struct ScopeInterval
+        {
+            IndexRange range;
+            IndexScope* scope;
+            //! Index of the enclosing interval in #_scope_intervals, #NO_ENCLOSING_INTERVAL if none.
+            std::size_t parent;
+        };
+        static constexpr std::size_t NO_ENCLOSING_INTERVAL = std::numeric_limits<std::size_t>::max();
+
+        /**
+         * @brief Ranges of #_scopes starting in this file, sorted by start location, outer ones first.
+         * 
+         * As scopes ranges nest, the innermost scope holding a location is found by a binary 
+         * search of the last range starting before the location, then by going up the enclosing
+         * intervals until one holds the location.
+         * Built by #prepare_scope_lookups, the lookups never modify it.
+         */
+        std::vector<ScopeInterval> _scope_intervals;
+        //! Reset when a scope is registered, until #_scope_intervals is built again.
+        bool _scope_intervals_built;
+        //! Declared symbols, built in the arena of the index.
+        std::pmr::unordered_map<IndexRange, IndexSymbol*> _declarations;
+        IndexArena* _arena;
         
-        // References are located by start of location.
-        // In order to lookup a reference, use upper_bound -1 and check the range
-        std::map<IndexLocation, ReferenceRecord> _references;
+        /**
+         * @brief References of the file, at most one per start location.
+         * 
+         * References are appended while the file is indexed, then sorted by start location 
+         * by #freeze_references. In order to lookup a reference, use upper_bound -1 and check
+         * the range.
+         */
+        std::vector<ReferenceRecord> _references;
+
+        //! Start locations of #_references, to skip duplicates while references are added.
+        //! Dropped when the references are frozen.
+        std::unordered_set<IndexLocation> _reference_starts;
+
+        //! Set when #_references is sorted.
+        bool _references_frozen;
 
         /**
          * @brief This container holds the list of additional scopes that should be looked up
@@ -55,27 +98,60 @@ namespace diplomat::index
             std::vector<std::string> _failed_references;
         #endif
 
+        void _build_scope_intervals();
+
+        /**
+         * @brief Get the last interval of #_scope_intervals starting at or before \p loc.
+         * @return Index of the interval, #NO_ENCLOSING_INTERVAL if none.
+         */
+        std::size_t _last_scope_interval_before(const IndexLocation& loc) const;
+
 
     public:
-        IndexFile(const std::filesystem::path& path);
+        IndexFile(IndexArena& arena, const std::filesystem::path& path);
+        IndexFile(IndexArena& arena, std::uint32_t file_id);
         ~IndexFile() = default;
 
         IndexSymbol* add_symbol(const std::string_view& name, const IndexRange& location, const std::string_view& kind = "");
         void register_scope(IndexScope* _scope); 
-        IndexScope* lookup_scope_by_range(const IndexRange& loc);
-        IndexScope* lookup_scope_by_exact_range(const IndexRange& loc);
-        IndexScope* lookup_scope_by_location(const IndexLocation& loc);
+
+        /**
+         * @brief Get the innermost scope of the file that includes the given range.
+         * @note Scope lookups require #prepare_scope_lookups to be called after the last
+         * scope is registered. They may then run concurrently.
+         */
+        IndexScope* lookup_scope_by_range(const IndexRange& loc) const;
+        IndexScope* lookup_scope_by_exact_range(const IndexRange& loc) const;
+
+        /**
+         * @brief Get the innermost scope of the file that includes the given location.
+         */
+        IndexScope* lookup_scope_by_location(const IndexLocation& loc) const;
+
+        /**
+         * @brief Build the scope lookup table, once all scopes are registered.
+         */
+        inline void prepare_scope_lookups() {if(! _scope_intervals_built) _build_scope_intervals();};
 
         IndexSymbol* lookup_symbol_by_location(const IndexLocation& loc);
 
         void add_reference(IndexSymbol* symb, const IndexRange& range, bool is_definition = false );
-        inline const std::map<IndexLocation, ReferenceRecord>& get_references() const {return _references;};
+        inline const std::vector<ReferenceRecord>& get_references() const {return _references;};
+
+        /**
+         * @brief Sort the references by location, once all of them are added, 
+         * and release the structures only used while adding them.
+         * References may still be added afterwards, at the cost of another sort.
+         */
+        void freeze_references();
         inline auto get_symbols() const {return std::views::values(_declarations);};
 
         inline void set_syntax_root(const slang::syntax::SyntaxNode* node ) {_syntax_root = node;};
         inline const slang::syntax::SyntaxNode* get_syntax_root() const {return _syntax_root.value_or(nullptr);};
+        inline void release_syntax_root() {_syntax_root.reset();};
 
         inline const std::filesystem::path& get_path() const {return _filepath;} ;
+        inline std::uint32_t get_file_id() const {return _file_id;} ;
 
         void record_additionnal_lookup_scope(const std::string& path, IndexScope* target = nullptr);
         void invalidate_additionnal_lookup_scope(const std::string& path);
@@ -5,7 +5,9 @@
 #include <slang/parsing/Token.h>
 
 #include <memory>
+#include <string>
 #include <string_view>
+#include <vector>
 
 #include "index_core.hpp"
 
@@ -19,6 +21,25 @@ namespace diplomat::index
 		IndexCore* _index;
 
 		IndexScope* _instance_scope;
+
+		/**
+		 * @brief Reference found by the visitor, added to the index by #commit.
+		 */
+		struct PendingReference
+		{
+			IndexFile* file;
+			IndexSymbol* symbol;
+			IndexRange range;
+		};
+
+		std::vector<PendingReference> _pending;
+
+		#ifdef DIPLOMAT_DEBUG
+		std::vector<std::pair<IndexFile*, std::string>> _pending_failures;
+		inline void _add_failed_ref(IndexFile* file, std::string ref_text) {_pending_failures.emplace_back(file, std::move(ref_text));};
+		#else
+		constexpr void _add_failed_ref(IndexFile* file, const std::string& ref_text) {};
+		#endif
 		
 		bool _add_reference_from_stx(const slang::SourceRange & loc, const std::string_view& name);
 		bool _add_reference_to_symbol(const slang::SourceRange& loc, const std::string_view& symbol_name);
@@ -34,7 +55,15 @@ namespace diplomat::index
 		 */
 		void _select_instance_scope(const IndexLocation& curr_scope_loc, const::std::string_view& next_scope);
 	public :
-		explicit ReferenceVisitor(const slang::SourceManager* sm, IndexCore* idx) : _sm(sm), _index(idx) {};
+		explicit ReferenceVisitor(const slang::SourceManager* sm, IndexCore* idx) : _sm(sm), _index(idx), _instance_scope(nullptr) {};
+
+			/**
+			 * @brief Add the references found so far to the index.
+			 * 
+			 * While visiting, the index is only read, so that visitors of different files may run
+			 * concurrently. Their references are then committed one visitor at a time.
+			 */
+			void commit();
 
 			// void handle(const slang::syntax::ModuleHeaderSyntax& node);
 			void handle(const slang::syntax::HierarchyInstantiationSyntax& node);
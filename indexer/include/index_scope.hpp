@@ -32,8 +32,11 @@
 #include "nlohmann/json.hpp"
 #include "index_elements.hpp"
 #include "index_symbols.hpp"
+#include "index_arena.hpp"
 #include <memory>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <optional>
 #include <filesystem>
@@ -46,11 +49,17 @@ namespace diplomat::index
 
         friend void to_json(nlohmann::json& j, const IndexScope& s);
 	    friend void from_json(const nlohmann::json& j, IndexScope& s); 
+        friend class IndexSerializer;
 
     protected:
-        std::string _name;
+        /**
+         * @brief Arena of the index, which holds this scope, its children and all their names.
+         * Scopes are never destroyed, see IndexArena.
+         */
+        IndexArena* _arena;
+        std::string_view _name;
         IndexScope* _parent;
-        std::unordered_map<std::string, std::unique_ptr<IndexScope> > _children;
+        std::pmr::unordered_map<std::string_view, IndexScope*> _children;
         
         /**
          * @brief When two sub scope are refering to the same piece of code,
@@ -58,7 +67,7 @@ namespace diplomat::index
          * scope, thus easing the process of lookups 
          * 
          */
-        std::unordered_map<std::string, IndexScope*> _child_aliases;
+        std::pmr::unordered_map<std::string_view, IndexScope*> _child_aliases;
 
         /**
          * @brief Range that cover the scope declaration and content
@@ -66,7 +75,7 @@ namespace diplomat::index
         std::optional<IndexRange> _source_range;
 
         // Symbols should be created as a file level, then forwarded to the scope for registering.
-        std::unordered_map<std::string, IndexSymbol*> _content;
+        std::pmr::unordered_map<std::string_view, IndexSymbol*> _content;
 
         /**
          * @brief This variable represents the fact that the scope impacts the design hierarchy
@@ -108,8 +117,7 @@ namespace diplomat::index
         std::string _get_unnamed_id();
 
     public:
-        IndexScope() = default;
-        IndexScope(std::string name, bool isvirtual = false, bool anonymous = false);
+        IndexScope(IndexArena& arena, std::string_view name, bool isvirtual = false, bool anonymous = false);
         ~IndexScope() = default;
 
         inline void set_kind(const std::string_view& kind) {
@@ -125,7 +133,7 @@ namespace diplomat::index
          * @param is_virtual sets the "virtual" flag of the new scope
          * @return std::shared_ptr<IndexScope> the shared pointer to manipulate said scope.
          */
-        IndexScope* add_child(const std::string& name, const bool is_virtual = false);
+        IndexScope* add_child(std::string_view name, const bool is_virtual = false);
 
         /**
          * @brief Add an alias for the specified child, then return the actual scope if OK,
@@ -135,7 +143,7 @@ namespace diplomat::index
          * @param alias Name of the alias
          * @return IndexScope* reference child if the alias is in place, nullptr otherwise
          */
-        IndexScope* add_child_alias(const std::string& ref, const std::string& alias);
+        IndexScope* add_child_alias(std::string_view ref, std::string_view alias);
 
         /** 
          * @brief Add a symbol to the scope.
@@ -151,7 +159,7 @@ namespace diplomat::index
          * @param strict If strict is false, recursively lookup in virtual parent scopes until the symbol is found
          * @return IndexSymbol* pointer to the symbol if found, nullptr otherwise
          */
-        IndexSymbol* lookup_symbol(const std::string& name, bool strict = false);
+        IndexSymbol* lookup_symbol(std::string_view name, bool strict = false);
 
         /**
          * @brief Retrieve a symbol based upon its fully qualified name, relative to the current scope.
@@ -231,7 +239,7 @@ namespace diplomat::index
         inline size_t get_hash_value() const { return _hash_value; };
 
         inline bool get_parent_access() const { return _is_virtual;} ;
-        inline const std::string& get_name() const {return _name;};
+        inline std::string_view get_name() const {return _name;};
 
         inline void set_source(const IndexRange& range) {_source_range = range;};
         inline const std::optional<IndexRange>& get_source_range() const { return _source_range;};
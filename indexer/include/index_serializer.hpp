@@ -0,0 +1,50 @@
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "index_core.hpp"
+#include "nlohmann/json.hpp"
+
+namespace diplomat::index
+{
+	/**
+	 * @brief Full (de)serialization of an index, such that it can be built in a process
+	 * and used in another one.
+	 *
+	 * Unlike the JSON dumps, which are meant to be read, the serialized form keeps all the links
+	 * between the scopes, the symbols and the references. Scopes and symbols are therefore
+	 * numbered, and refered to by their number. Ranges are stored as arrays of integers,
+	 * with the file paths stored once.
+	 *
+	 * The syntax roots of the files are not kept, so that references shall be processed
+	 * before serializing the index.
+	 */
+	class IndexSerializer
+	{
+	public:
+		/**
+		 * @brief Serialize an index.
+		 *
+		 * @param index Index to serialize
+		 * @return nlohmann::json Serialized index, expected to be stored in a binary format (CBOR, MessagePack...)
+		 */
+		static nlohmann::json save(const IndexCore& index);
+
+		/**
+		 * @brief Rebuild an index from its serialized form.
+		 *
+		 * @param data Serialized index, as built by #save
+		 * @return std::unique_ptr<IndexCore> Rebuilt index
+		 * @throws std::runtime_error if the serialized index is inconsistent.
+		 */
+		static std::unique_ptr<IndexCore> load(const nlohmann::json& data);
+
+	protected:
+		/**
+		 * @brief Number a scope and all its children, parents first.
+		 */
+		static void _number_scopes(const IndexScope* scope, std::unordered_map<const IndexScope*, std::size_t>& ids, std::vector<const IndexScope*>& order);
+	};
+}
@@ -1,8 +1,11 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <optional>
 #include <unordered_set>
+#include <memory_resource>
 
+#include "index_arena.hpp"
 #include "index_elements.hpp"
 
 #include "nlohmann/json.hpp"
@@ -15,26 +18,26 @@ namespace diplomat::index
 		friend struct std::hash<diplomat::index::IndexSymbol>;
 		friend void to_json(nlohmann::json& j, const IndexSymbol*& s);
 		friend void to_json(nlohmann::json& j, const IndexSymbol& s);
-		friend void from_json(const nlohmann::json& j, IndexSymbol& s); 
+		friend class IndexSerializer;
 
 	protected:
 		// The file linking will be done in the index_file, on a second time.
 		// The file-linking "key" will be the flesystem::path from the _source_range.
-		std::string _name;
+		// Symbols are built in the arena of their index, see IndexArena.
+		// The name is interned there, and the references allocated from there.
+		std::string_view _name;
 		std::optional<IndexRange> _source_range;
-		std::unordered_set<IndexRange> _references_locations;
+		std::pmr::unordered_set<IndexRange> _references_locations;
 
 		#ifdef DIPLOMAT_DEBUG
 		std::string_view _kind;
 		#endif
 
 	public : 
-		IndexSymbol() = default;
-		IndexSymbol(const std::string& name);
-		IndexSymbol(const std::string& name, const IndexRange& range);
-		IndexSymbol(const std::string_view name, const IndexRange range);
-		IndexSymbol(const slang::syntax::SyntaxNode& node, const slang::SourceManager& sm);
-		IndexSymbol(const slang::ast::Symbol& node, const slang::SourceManager& sm);
+		IndexSymbol(IndexArena& arena, std::string_view name);
+		IndexSymbol(IndexArena& arena, std::string_view name, const IndexRange& range);
+		IndexSymbol(IndexArena& arena, const slang::syntax::SyntaxNode& node, const slang::SourceManager& sm);
+		IndexSymbol(IndexArena& arena, const slang::ast::Symbol& node, const slang::SourceManager& sm);
 		~IndexSymbol() = default;
 
 		void add_reference(IndexRange ref_location);
@@ -48,15 +51,14 @@ namespace diplomat::index
 		
 		inline const std::optional<IndexRange>& get_source() const {return _source_range;};
 		inline const std::optional<IndexLocation> get_source_location() const {return _source_range ? _source_range->start : std::optional<IndexLocation>();};
-		inline const std::string& get_name() const {return _name;};
-		inline const std::unordered_set<IndexRange>& get_references() const {return _references_locations;};
+		inline std::string_view get_name() const {return _name;};
+		inline const std::pmr::unordered_set<IndexRange>& get_references() const {return _references_locations;};
 
 
 	};
 
 	void to_json(nlohmann::json& j, const IndexSymbol& s);
 	void to_json(nlohmann::json& j, const IndexSymbol*& s);
-	void from_json(const nlohmann::json& j, IndexSymbol& s); 
 
 }
 
@@ -66,14 +68,13 @@ struct std::hash<diplomat::index::IndexSymbol>
 {
 	std::size_t operator()(const diplomat::index::IndexSymbol& s) const noexcept
 	{
-		std::size_t ret = 0;
+		std::size_t ret = std::hash<std::string_view>{}(s._name);
 		// The positioning only cannot be used as a hash value, as we want to be able
 		// to use an "unbound" symbol to ease development.
 		// However, as a symbol declaration shall be unique across a scope, there should not be
 		// any issue with using the symbol name as a hash key.
-		diplomat::hash_combine(ret,std::hash<std::string>{}(s._name));
 		if(s._source_range)
-			diplomat::hash_combine(ret,std::hash<diplomat::index::IndexRange>{}(s._source_range.value()));
+			ret = diplomat::hash_combine(ret,std::hash<diplomat::index::IndexRange>{}(s._source_range.value()));
 		return ret;
 	}
 };
\ No newline at end of file
@@ -0,0 +1,24 @@
+#include "index_arena.hpp"
+
+#include <algorithm>
+
+namespace diplomat::index
+{
+	//! First block allocated by an arena, following ones grow geometrically.
+	static constexpr std::size_t ARENA_INITIAL_SIZE = 64 * 1024;
+
+	IndexArena::IndexArena() : _resource(ARENA_INITIAL_SIZE), _strings(&_resource)
+	{
+	}
+
+	std::string_view IndexArena::intern(std::string_view str)
+	{
+		auto found = _strings.find(str);
+		if(found != _strings.end())
+			return *found;
+
+		char* copy = static_cast<char*>(_resource.allocate(std::max<std::size_t>(str.size(), 1), alignof(char)));
+		std::copy(str.begin(), str.end(), copy);
+		return *_strings.emplace(copy, str.size()).first;
+	}
+}
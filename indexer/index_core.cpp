@@ -1,22 +1,27 @@
 #include "index_core.hpp"
 #include "index_reference_visitor.hpp"
 
+#include "slang/util/ThreadPool.h"
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 namespace diplomat::index {
-	IndexScope* IndexCore::set_root_scope(const std::string name)
+	IndexScope* IndexCore::set_root_scope(std::string_view name)
 	{
-		_root.reset(new IndexScope(name,false));
-		return _root.get();
+		// A replaced root is only released along with the arena.
+		_root = _arena.create<IndexScope>(_arena,name,false);
+		return _root;
 	}
 
 	IndexFile *IndexCore::add_file(const std::filesystem::path& path)
 	{
-		std::filesystem::path lookup_path = std::filesystem::weakly_canonical(path);
-		if(! _files.contains(lookup_path))
-			_files.emplace(lookup_path,new IndexFile(lookup_path));
-
-		return _files.at(lookup_path).get();
+		return add_file_by_id(FileTable::get_id(path));
 	}
 
 	IndexFile *IndexCore::add_file(const std::string_view& path)
@@ -24,31 +29,151 @@ namespace diplomat::index {
 		return add_file(std::filesystem::path(path));
 	}
 
-	IndexFile *IndexCore::get_file(const std::filesystem::path& path)
+	IndexFile *IndexCore::add_file_by_id(std::uint32_t file_id)
 	{
-		std::filesystem::path lookup_path = std::filesystem::weakly_canonical(path);
-		if(! _files.contains(lookup_path))
-			return nullptr;
+		auto [it, inserted] = _files_by_id.try_emplace(file_id, nullptr);
+		if(inserted)
+		{
+			std::unique_ptr<IndexFile> new_file = std::make_unique<IndexFile>(_arena, file_id);
+			it->second = new_file.get();
+			_files.emplace(new_file->get_path(), std::move(new_file));
+		}
+
+		return it->second;
+	}
 
-		return _files.at(lookup_path).get();
+	IndexFile *IndexCore::get_file(const std::filesystem::path& path)
+	{
+		return get_file_by_id(FileTable::get_id(path));
 	}
 
 	const IndexFile* IndexCore::get_file(const std::filesystem::path& path) const
 	{
-		std::filesystem::path lookup_path = std::filesystem::weakly_canonical(path);
-		if(! _files.contains(lookup_path))
-			return nullptr;
+		return get_file_by_id(FileTable::get_id(path));
+	}
 
-		return _files.at(lookup_path).get();
+	IndexFile *IndexCore::get_file_by_id(std::uint32_t file_id)
+	{
+		auto found = _files_by_id.find(file_id);
+		return found == _files_by_id.end() ? nullptr : found->second;
+	}
+
+	const IndexFile* IndexCore::get_file_by_id(std::uint32_t file_id) const
+	{
+		auto found = _files_by_id.find(file_id);
+		return found == _files_by_id.end() ? nullptr : found->second;
 	}
 
 	IndexSymbol *IndexCore::add_symbol(const std::string_view& name, const IndexRange& src_range, const std::string_view& kind)
 	{
-		IndexFile* f = add_file(src_range.start.file);
+		IndexFile* f = add_file_by_id(src_range.start.file_id);
 		IndexSymbol* s = f->add_symbol(name,src_range,kind);
 		return s;
 	}
 
+	/**
+	 * The visitors only read the index: scope lookup tables and additionnal lookup scopes 
+	 * are resolved beforehand, and the references found are buffered by each visitor. 
+	 * Buffers are then committed in the order of the files, as a serial pass would have added them.
+	 */
+	bool IndexCore::process_references(const slang::SourceManager& sm, unsigned int threads, const std::function<bool()>& cancelled)
+	{
+		struct ReferenceJob
+		{
+			IndexFile* file;
+			std::unique_ptr<ReferenceVisitor> visitor;
+		};
+		std::vector<ReferenceJob> jobs;
+
+		for(auto& [path, idx_file] : _files)
+		{
+			idx_file->prepare_scope_lookups();
+
+			std::vector<std::string> invalid_paths;
+			for(const auto& [lu_path, lu_scope] : *idx_file->get_additionnal_scopes())
+			{
+				if(lu_scope)
+					continue;
+
+				// Updating a recorded path does not change the iterated map.
+				IndexScope* resolved = lookup_scope(lu_path);
+				if(resolved)
+					idx_file->record_additionnal_lookup_scope(lu_path,resolved);
+				else
+					invalid_paths.push_back(lu_path);
+			}
+			for(const std::string& lu_path : invalid_paths)
+				idx_file->invalidate_additionnal_lookup_scope(lu_path);
+
+			if(idx_file->get_syntax_root())
+				jobs.push_back(ReferenceJob{idx_file.get(), std::make_unique<ReferenceVisitor>(&sm,this)});
+			else
+				spdlog::warn("No syntax node available for {}. No reference processed.", path.generic_string());
+		}
+
+		std::atomic_bool stopped = false;
+		std::exception_ptr error;
+		std::mutex error_access;
+		auto run_job = [&](ReferenceJob& job) {
+			if(stopped.load() || (cancelled && cancelled()))
+			{
+				stopped = true;
+				return;
+			}
+
+			spdlog::info("Processing references for {}",job.file->get_path().generic_string());
+			try
+			{
+				job.file->get_syntax_root()->visit(*job.visitor);
+			}
+			catch(...)
+			{
+				std::lock_guard lock(error_access);
+				if(! error)
+					error = std::current_exception();
+				stopped = true;
+			}
+		};
+
+		if(jobs.size() > 1)
+		{
+			slang::ThreadPool pool(std::min<std::size_t>(threads ? threads : std::thread::hardware_concurrency(), jobs.size()));
+			for(ReferenceJob& job : jobs)
+				pool.pushTask([&run_job, &job]() { run_job(job); });
+			pool.waitForAll();
+		}
+		else
+		{
+			for(ReferenceJob& job : jobs)
+				run_job(job);
+		}
+
+		if(error)
+			std::rethrow_exception(error);
+		if(stopped)
+			return false;
+
+		for(ReferenceJob& job : jobs)
+			job.visitor->commit();
+
+		return true;
+	}
+
+	void IndexCore::release_syntax()
+	{
+		for(auto& [path, idx_file] : _files)
+			idx_file->release_syntax_root();
+	}
+
+	void IndexCore::freeze_references()
+	{
+		for(auto& [path, idx_file] : _files)
+		{
+			idx_file->freeze_references();
+			idx_file->prepare_scope_lookups();
+		}
+	}
+
 	nlohmann::json IndexCore::dump_symbol_list() const
 	{
 		using namespace nlohmann; 
@@ -56,9 +181,9 @@ namespace diplomat::index {
 		for(const auto& [path, idx_file] : _files )
 		{
 			json file_content = json::array();
-			for(const auto& [loc, ref] : idx_file->get_references())
+			for(const ReferenceRecord& ref : idx_file->get_references())
 			{
-				file_content.push_back({{"loc",loc},{"des",ref.key->get_name()},{"to",ref.key->get_source_location()}});
+				file_content.push_back({{"loc",ref.loc.start},{"des",ref.key->get_name()},{"to",ref.key->get_source_location()}});
 			}
 			ret[path.generic_string()] = file_content;
 		}
@@ -68,15 +193,16 @@ namespace diplomat::index {
 
 	IndexScope* IndexCore::get_scope_by_position(const IndexLocation& pos)
 	{
-		if(! _files.contains(pos.file))
+		IndexFile* ref_file = get_file_by_id(pos.file_id);
+		if(! ref_file)
 			return nullptr;
 		else
-			return _files.at(pos.file)->lookup_scope_by_location(pos);
+			return ref_file->lookup_scope_by_location(pos);
 	}
 
 	const IndexSymbol* IndexCore::get_symbol_by_position(const IndexLocation& pos)
 	{
-		IndexFile* ref_file = get_file(pos.file);
+		IndexFile* ref_file = get_file_by_id(pos.file_id);
 		if(! ref_file)
 			return nullptr;
 		return ref_file->lookup_symbol_by_location(pos);
@@ -91,7 +217,7 @@ namespace diplomat::index {
 	{
 
 		j = nlohmann::json{
-			{"hier",s._root},
+			{"hier",s._root ? nlohmann::json(*s._root) : nlohmann::json()},
 			{"files",s._files}};
 	}
 }
\ No newline at end of file
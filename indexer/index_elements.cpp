@@ -2,6 +2,12 @@
 
 #include <fmt/format.h>
 
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
 
 namespace diplomat {
 	size_t hash_combine(size_t lhs, size_t rhs)
@@ -19,39 +25,91 @@ namespace diplomat {
 }
 namespace diplomat::index
 {
-	IndexLocation::IndexLocation() : line(0), column(0), file()
+	namespace
+	{
+		struct FileTableStorage
+		{
+			std::shared_mutex access;
+			//! Never shrinks, so that references to the paths stay valid.
+			std::deque<std::filesystem::path> paths{std::filesystem::path()};
+			std::unordered_map<std::filesystem::path, std::uint32_t> ids{{std::filesystem::path(), 0}};
+			//! IDs by path as requested, to canonicalize each spelling once.
+			std::unordered_map<std::string, std::uint32_t> spellings{{std::string(), 0}};
+		};
+
+		FileTableStorage& file_table()
+		{
+			static FileTableStorage storage;
+			return storage;
+		}
+	}
+
+	std::uint32_t FileTable::get_id(const std::filesystem::path& path)
+	{
+		FileTableStorage& table = file_table();
+		{
+			std::shared_lock lock(table.access);
+			auto found = table.spellings.find(path.native());
+			if(found != table.spellings.end())
+				return found->second;
+		}
+
+		// Canonicalization accesses the file system, do it outside of the lock.
+		std::filesystem::path canonical = std::filesystem::weakly_canonical(path);
+
+		std::unique_lock lock(table.access);
+		auto [it, inserted] = table.ids.try_emplace(canonical, static_cast<std::uint32_t>(table.paths.size()));
+		if(inserted)
+			table.paths.push_back(canonical);
+		table.spellings.emplace(path.native(), it->second);
+		return it->second;
+	}
+
+	const std::filesystem::path& FileTable::get_path(std::uint32_t id)
+	{
+		FileTableStorage& table = file_table();
+		std::shared_lock lock(table.access);
+		return table.paths.at(id);
+	}
+
+	IndexLocation::IndexLocation() : line(0), column(0), file_id(0)
 	{}
 
 	IndexLocation::IndexLocation(const std::filesystem::path& file, std::size_t line,
 	                             std::size_t column) : 
-	line(line), 
-	column(column), 
-	file(std::filesystem::weakly_canonical(file))
+	IndexLocation(FileTable::get_id(file), line, column)
+	{
+	}
+
+	IndexLocation::IndexLocation(std::uint32_t file_id, std::size_t line, std::size_t column) :
+	line(static_cast<std::uint32_t>(line)),
+	column(static_cast<std::uint32_t>(column)),
+	file_id(file_id)
 	{
 	}
 
 IndexLocation::IndexLocation(const slang::SourceLocation& loc, const slang::SourceManager& sm)
 {
 	slang::SourceLocation location = sm.getFullyOriginalLoc(loc);
-	file = std::filesystem::weakly_canonical(sm.getFullPath(location.buffer()));
-	line = sm.getLineNumber(location);
-	column = sm.getColumnNumber(location);
+	file_id = FileTable::get_id(sm.getFullPath(location.buffer()));
+	line = static_cast<std::uint32_t>(sm.getLineNumber(location));
+	column = static_cast<std::uint32_t>(sm.getColumnNumber(location));
 }
 
 bool IndexLocation::operator==(const IndexLocation &rhs) const
 {
-	return rhs.line == line && rhs.column == column && rhs.file == file;
+	return rhs.line == line && rhs.column == column && rhs.file_id == file_id;
 }
 
 std::string index::IndexLocation::to_string() const
 {
-	return fmt::format("{}:{}:{}",file.generic_string(),line,column);
+	return fmt::format("{}:{}:{}",file().generic_string(),line,column);
 ;
 }
 
 std::strong_ordering IndexLocation::operator<=>(const IndexLocation& rhs) const
 {
-	if(rhs.file != file)
+	if(rhs.file_id != file_id)
 		throw std::logic_error("Trying to compare position from different files");
 	if(line < rhs.line)
 		return std::strong_ordering::less;
@@ -81,13 +139,13 @@ index::IndexRange::IndexRange(const IndexLocation& base, std::size_t nchars, std
 {
 	start = base;
 	end = base;
-	end.column += nchars;
-	end.line += nlines;
+	end.column += static_cast<std::uint32_t>(nchars);
+	end.line += static_cast<std::uint32_t>(nlines);
 }
 
-bool IndexRange::contains(const IndexLocation& loc)
+bool IndexRange::contains(const IndexLocation& loc) const
 {
-	if(loc.file != start.file)
+	if(loc.file_id != start.file_id)
 		return false;
 	
 	if(loc.line < start.line || loc.line > end.line)
@@ -103,9 +161,9 @@ bool IndexRange::contains(const IndexLocation& loc)
 
 }
 
-bool IndexRange::contains(const IndexRange &loc)
+bool IndexRange::contains(const IndexRange &loc) const
 {
-	if(loc.start.file != start.file)
+	if(loc.start.file_id != start.file_id)
 		return false;
 	
 	if(loc.start.line < start.line || loc.end.line > end.line)
@@ -137,7 +195,7 @@ void to_json(nlohmann::json &j, const IndexLocation &s)
 
 void from_json(const nlohmann::json &j, IndexLocation &s)
 {
-	s.file = std::filesystem::path(j.at("f").template get<std::string>());
+	s.file_id = FileTable::get_id(j.at("f").template get<std::string>());
 	j.at("l").get_to(s.line);
 	j.at("c").get_to(s.column);
 }
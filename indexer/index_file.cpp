@@ -1,95 +1,188 @@
 #include "index_file.hpp"
 #include <spdlog/spdlog.h>
 #include <cassert>
+#include <algorithm>
+#include <iterator>
 namespace diplomat::index {
-	IndexFile::IndexFile(const std::filesystem::path& path)
+	IndexFile::IndexFile(IndexArena& arena, const std::filesystem::path& path) : IndexFile(arena, FileTable::get_id(path))
+	{
+	}
+
+	IndexFile::IndexFile(IndexArena& arena, std::uint32_t file_id) : 
+		_filepath(FileTable::get_path(file_id)), _file_id(file_id), 
+		_scope_intervals_built(false), _declarations(arena.resource()), _arena(&arena), _references_frozen(true)
 	{
-		_filepath = std::filesystem::weakly_canonical(path);
 	}
 
 	IndexSymbol *IndexFile::add_symbol(const std::string_view &name, const IndexRange &location, const std::string_view& kind)
 	{
 
-		auto [eltpair, inserted] = _declarations.emplace(location,std::make_unique<IndexSymbol>(std::string(name),location));
+		auto [eltpair, inserted] = _declarations.try_emplace(location,nullptr);
 		if(inserted)
 		{
+			eltpair->second = _arena->create<IndexSymbol>(*_arena,name,location);
 			#ifdef DIPLOMAT_DEBUG
 			eltpair->second->set_kind(kind);
 			#endif
-			add_reference(eltpair->second.get(), eltpair->first,true);
+			add_reference(eltpair->second, eltpair->first,true);
 		}
 
-		return eltpair->second.get();
+		return eltpair->second;
 	}
 
 	void IndexFile::register_scope(IndexScope *_scope)
 	{
 		_scopes.insert({_scope->get_full_path(),_scope});
+		_scope_intervals_built = false;
 	}
 
-	IndexScope* IndexFile::lookup_scope_by_range(const IndexRange& range)
+	/**
+	 * Enclosing intervals are found with a stack of the intervals that are still open
+	 * at the start of the processed one.
+	 */
+	void IndexFile::_build_scope_intervals()
 	{
-		IndexScope* ret;
-		for(auto&  scope : std::views::values(_scopes))
+		_scope_intervals.clear();
+		for(IndexScope* scope : std::views::values(_scopes))
 		{
-			if((ret = scope->get_scope_for_range(range)) != nullptr)
-				return ret;
+			const std::optional<IndexRange>& range = scope->get_source_range();
+			// Ranges starting in another file cannot include any location of this one.
+			if(range && range->start.file_id == _file_id)
+				_scope_intervals.push_back(ScopeInterval{*range, scope, NO_ENCLOSING_INTERVAL});
 		}
-		return nullptr;
-	}
 
-	IndexScope* IndexFile::lookup_scope_by_exact_range(const IndexRange& loc)
-	{
-		for(auto&  scope : std::views::values(_scopes))
+		std::sort(_scope_intervals.begin(), _scope_intervals.end(), [](const ScopeInterval& lhs, const ScopeInterval& rhs) {
+			if(lhs.range.start != rhs.range.start)
+				return lhs.range.start < rhs.range.start;
+			// End files may differ from the start one, only compare the positions.
+			if(lhs.range.end.line != rhs.range.end.line)
+				return lhs.range.end.line > rhs.range.end.line;
+			return lhs.range.end.column > rhs.range.end.column;
+		});
+
+		std::vector<std::size_t> open_intervals;
+		for(std::size_t i = 0; i < _scope_intervals.size(); i++)
 		{
-			if(loc == scope->get_source_range())
-				return scope;
+			while(! open_intervals.empty() && ! _scope_intervals[open_intervals.back()].range.contains(_scope_intervals[i].range))
+				open_intervals.pop_back();
+			
+			if(! open_intervals.empty())
+				_scope_intervals[i].parent = open_intervals.back();
+			open_intervals.push_back(i);
 		}
-		return nullptr;
+
+		_scope_intervals_built = true;
 	}
 
-	IndexScope* IndexFile::lookup_scope_by_location(const IndexLocation& loc)
+	std::size_t IndexFile::_last_scope_interval_before(const IndexLocation& loc) const
 	{
-		IndexScope* ret;
-		for(auto&  scope : std::views::values(_scopes))
+		assert(_scope_intervals_built);
+		if(loc.file_id != _file_id)
+			return NO_ENCLOSING_INTERVAL;
+
+		auto lu_result = std::upper_bound(_scope_intervals.begin(), _scope_intervals.end(), loc,
+			[](const IndexLocation& lhs, const ScopeInterval& rhs) {return lhs < rhs.range.start;});
+		if(lu_result == _scope_intervals.begin())
+			return NO_ENCLOSING_INTERVAL;
+		return std::distance(_scope_intervals.begin(), lu_result) - 1;
+	}
+
+	IndexScope* IndexFile::lookup_scope_by_range(const IndexRange& range) const
+	{
+		std::size_t idx = _last_scope_interval_before(range.start);
+		while(idx != NO_ENCLOSING_INTERVAL && ! _scope_intervals[idx].range.contains(range))
+			idx = _scope_intervals[idx].parent;
+		return idx != NO_ENCLOSING_INTERVAL ? _scope_intervals[idx].scope : nullptr;
+	}
+
+	IndexScope* IndexFile::lookup_scope_by_exact_range(const IndexRange& loc) const
+	{
+		// A scope with the exact range includes the range start, so it is an enclosing one.
+		for(std::size_t idx = _last_scope_interval_before(loc.start); idx != NO_ENCLOSING_INTERVAL; idx = _scope_intervals[idx].parent)
 		{
-			if((ret = scope->get_scope_for_location(loc)) != nullptr)
-				return ret;
+			if(_scope_intervals[idx].range == loc)
+				return _scope_intervals[idx].scope;
 		}
 		return nullptr;
 	}
 
+	IndexScope* IndexFile::lookup_scope_by_location(const IndexLocation& loc) const
+	{
+		std::size_t idx = _last_scope_interval_before(loc);
+		while(idx != NO_ENCLOSING_INTERVAL && ! _scope_intervals[idx].range.contains(loc))
+			idx = _scope_intervals[idx].parent;
+		return idx != NO_ENCLOSING_INTERVAL ? _scope_intervals[idx].scope : nullptr;
+	}
+
+	/**
+	 * Frozen references are binary searched. Otherwise, which only happens while indexing,
+	 * they are scanned for the last one starting before \p loc.
+	 */
 	IndexSymbol* IndexFile::lookup_symbol_by_location(const IndexLocation& loc)
 	{
-		// Lookup method from https://stackoverflow.com/a/45426884
-		auto lu_result = _references.upper_bound(loc);
-		if(lu_result != _references.begin())
-			lu_result--;
+		const ReferenceRecord* candidate = nullptr;
+		if(_references_frozen)
+		{
+			// Lookup method from https://stackoverflow.com/a/45426884
+			auto lu_result = std::upper_bound(_references.begin(), _references.end(), loc, 
+				[](const IndexLocation& lhs, const ReferenceRecord& rhs) {return lhs < rhs.loc.start;});
+			if(lu_result != _references.begin())
+				candidate = &*std::prev(lu_result);
+		}
 		else
-			return nullptr;
-
-		if(lu_result->second.loc.contains(loc))
 		{
-			return lu_result->second.key;
+			for(const ReferenceRecord& ref : _references)
+			{
+				if(ref.loc.start <= loc && (! candidate || candidate->loc.start < ref.loc.start))
+					candidate = &ref;
+			}
 		}
+
+		if(candidate && candidate->loc.contains(loc))
+			return candidate->key;
 		else
 			return nullptr;
 	}
 
 	void IndexFile::add_reference(IndexSymbol* symb, const IndexRange& range, bool is_definition)
 	{
-		assert(range.start.file == _filepath);
-		if(! _references.try_emplace(range.start,range,symb,is_definition).second)
+		assert(range.start.file_id == _file_id);
+
+		// Adding to frozen references: the set of starts shall be built again.
+		if(_references_frozen && _reference_starts.size() != _references.size())
+		{
+			for(const ReferenceRecord& ref : _references)
+				_reference_starts.insert(ref.loc.start);
+		}
+
+		if(! _reference_starts.insert(range.start).second)
 		{
 			spdlog::debug("    Duplicate reference to {}", symb->get_name());
 		}
 		else
 		{
+			_references.emplace_back(range,symb,is_definition);
+			_references_frozen = false;
 			if(! is_definition)
 				symb->add_reference(range);
 		}
 	}
 
+	void IndexFile::freeze_references()
+	{
+		if(! _references_frozen)
+		{
+			// Starts are unique, so that the order is total.
+			std::sort(_references.begin(), _references.end(), [](const ReferenceRecord& lhs, const ReferenceRecord& rhs) {
+				return lhs.loc.start < rhs.loc.start;
+			});
+			_references_frozen = true;
+		}
+
+		_references.shrink_to_fit();
+		_reference_starts = {};
+	}
+
 	void IndexFile::record_additionnal_lookup_scope(const std::string& path, IndexScope* target)
 	{
 		spdlog::debug("Recording additionnal lookup scope {}.",path);
@@ -118,7 +211,7 @@ namespace diplomat::index {
 
 		for (const auto& [key, value] : s._declarations)
 		{
-			j["symbols"].push_back(value);
+			j["symbols"].push_back(*value);
 		}
 
 		
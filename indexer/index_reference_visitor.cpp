@@ -9,68 +9,67 @@ namespace diplomat::index
 	{
 		IndexRange node_loc(loc,*_sm);
 		spdlog::trace("    Found reference for name {} at {}", name, node_loc.start.to_string());
-		IndexFile* parent_file = _index->add_file(node_loc.start.file);
+		IndexFile* parent_file = _index->get_file_by_id(node_loc.start.file_id);
+		if(! parent_file)
+		{
+			spdlog::trace("        Reference dropped: file not indexed");
+			return false;
+		}
 
 		IndexScope* ref_scope = parent_file->lookup_scope_by_range(node_loc);
 		if(! ref_scope)
 		{
 			spdlog::trace("        Reference dropped: missing scope");
-			parent_file->_add_failed_ref(fmt::format("{} at {}",name,node_loc.start.to_string()));
+			_add_failed_ref(parent_file, fmt::format("{} at {}",name,node_loc.start.to_string()));
 			return false;
 		}
 
-		std::string symb_name(name);
-		IndexSymbol* main_symb = ref_scope->lookup_symbol(symb_name);
+		IndexSymbol* main_symb = ref_scope->lookup_symbol(name);
 
 		if(! main_symb)
 		{
-			const auto* additionnal_scopes = parent_file->get_additionnal_scopes();
-			if(additionnal_scopes->size() > 0)
+			// Additionnal scopes are resolved before the reference pass (see IndexCore::process_references)
+			// and are not updated from here, as the index may be read by other visitors.
+			for(const auto& [path, scope] : *parent_file->get_additionnal_scopes())
 			{
-				std::vector<std::string> invalid_paths;
-				for(auto& [path, scope] : *additionnal_scopes )
+				IndexScope* studied_scope = scope ? scope : _index->lookup_scope(path);
+				if(studied_scope)	
 				{
-					IndexScope* studied_scope = scope;
-					if(studied_scope == nullptr)
-					{
-						studied_scope = _index->lookup_scope(path);
-						if(studied_scope)
-							parent_file->record_additionnal_lookup_scope(path,studied_scope);
-						else
-							// Do not directly invalidate as it messes up the for loop by changing "additionnal_scopes".
-							invalid_paths.push_back(path);
-							
-					}
-
-					if(studied_scope)	
-					{
-						spdlog::trace("         Trying additionnal lookup in {}",studied_scope->get_name());
-						main_symb = studied_scope->lookup_symbol(symb_name);
-					}
-
-					if(main_symb)
-						break;
+					spdlog::trace("         Trying additionnal lookup in {}",studied_scope->get_name());
+					main_symb = studied_scope->lookup_symbol(name);
 				}
 
-				// Invalidate postponed paths
-				for(const auto& path : invalid_paths)
-					parent_file->invalidate_additionnal_lookup_scope(path);
+				if(main_symb)
+					break;
 			}
 		}
 
 		if(! main_symb)
 		{
-			parent_file->_add_failed_ref(fmt::format("{} at {}",name,node_loc.start.to_string()));
+			_add_failed_ref(parent_file, fmt::format("{} at {}",name,node_loc.start.to_string()));
 			spdlog::trace("        Reference dropped: failed to find symbol {} from scope {}",name, ref_scope->get_full_path());
 			return false;
 		}
 
-		parent_file->add_reference(main_symb,node_loc);
+		_pending.push_back(PendingReference{parent_file, main_symb, node_loc});
 
 		return true;
 
 	}
 
+	void ReferenceVisitor::commit()
+	{
+		for(const PendingReference& ref : _pending)
+			ref.file->add_reference(ref.symbol, ref.range);
+		_pending.clear();
+
+		#ifdef DIPLOMAT_DEBUG
+		for(auto& [file, ref_text] : _pending_failures)
+			file->_add_failed_ref(ref_text);
+		_pending_failures.clear();
+		#endif
+	}
+
 	void ReferenceVisitor::_select_instance_scope(const IndexLocation& curr_scope_loc,
 	                                              const ::std::string_view& next_scope)
 	{
@@ -92,7 +91,7 @@ namespace diplomat::index
 		if(! _instance_scope)
 			return false;
 
-		IndexSymbol* main_symb = _instance_scope->lookup_symbol(std::string(symbol_name));
+		IndexSymbol* main_symb = _instance_scope->lookup_symbol(symbol_name);
 		if(! main_symb)
 			return false;
 
@@ -100,9 +99,11 @@ namespace diplomat::index
 		
 		// This is most probably a cross-reference.
 		// Hence, the reference is situated at @loc while the symbol is elsewhere.
-		IndexFile* ref_file = _index->get_file(node_loc.start.file);
+		IndexFile* ref_file = _index->get_file_by_id(node_loc.start.file_id);
+		if(! ref_file)
+			return false;
 		
-		ref_file->add_reference(main_symb,node_loc);
+		_pending.push_back(PendingReference{ref_file, main_symb, node_loc});
 
 		return true;
 
@@ -17,28 +17,33 @@ struct std::hash<diplomat::index::IndexScope>
 namespace diplomat::index {
 
 
-	IndexScope::IndexScope(std::string name, bool is_virtual, bool anonymous) : 
-    _name(name),
-    _is_virtual(is_virtual),
+	IndexScope::IndexScope(IndexArena& arena, std::string_view name, bool is_virtual, bool anonymous) : 
+    _arena(&arena),
+    _name(arena.intern(name)),
     _parent(nullptr),
-	_anonymous(anonymous),
-	_unnamed_count(0)
+    _children(arena.resource()),
+    _child_aliases(arena.resource()),
+    _content(arena.resource()),
+    _is_virtual(is_virtual),
+	_unnamed_count(0),
+	_anonymous(anonymous)
     {
     }
 
-	IndexScope* IndexScope::add_child(const std::string& name, const bool isvirtual)
+	IndexScope* IndexScope::add_child(std::string_view name, const bool isvirtual)
 	{
-		std::string used_name = name;
+		std::string unnamed_id;
+		std::string_view used_name = name;
 		if(name.empty())
-			used_name = _get_unnamed_id();
+			used_name = unnamed_id = _get_unnamed_id();
 
-		if(_children.contains(used_name))
-			return _children.at(used_name).get();
+		auto found = _children.find(used_name);
+		if(found != _children.end())
+			return found->second;
 		
-		std::unique_ptr<IndexScope> up = std::make_unique<IndexScope>(used_name, isvirtual, name.empty());
-		IndexScope* elt = up.get();
-		up->_parent = this;
-		_children[used_name] = std::move(up);
+		IndexScope* elt = _arena->create<IndexScope>(*_arena, used_name, isvirtual, name.empty());
+		elt->_parent = this;
+		_children.emplace(elt->_name, elt);
 
 		// Once the hierarchical path is built, (re)compute the hash value.
 		elt->compute_hash_value();
@@ -46,12 +51,12 @@ namespace diplomat::index {
 		return elt;
 	}
 
-	IndexScope* IndexScope::add_child_alias(const std::string& ref, const std::string& alias)
+	IndexScope* IndexScope::add_child_alias(std::string_view ref, std::string_view alias)
 	{
 
 		IndexScope* ref_scope = nullptr;
 		if(_children.contains(ref))
-			ref_scope = _children.at(ref).get();
+			ref_scope = _children.at(ref);
 		else if(_child_aliases.contains(ref))
 			ref_scope = _child_aliases.at(alias);
 		else
@@ -63,7 +68,7 @@ namespace diplomat::index {
 			spdlog::trace("Alias name is empty, forcing the aliasing.");
 		}
 
-		auto emplace_ret = _child_aliases.try_emplace(alias.empty() ? _get_unnamed_id() : alias,ref_scope); 
+		auto emplace_ret = _child_aliases.try_emplace(_arena->intern(alias.empty() ? _get_unnamed_id() : std::string(alias)),ref_scope); 
 		if(emplace_ret.second || emplace_ret.first->second == ref_scope)
 			return ref_scope;
 		else
@@ -79,7 +84,7 @@ namespace diplomat::index {
 		_content[symb->get_name()] = symb;
 	}
 
-	IndexSymbol* IndexScope::lookup_symbol(const std::string &name, bool strict)
+	IndexSymbol* IndexScope::lookup_symbol(std::string_view name, bool strict)
 	{
 
 		if( _content.contains(name))
@@ -103,7 +108,7 @@ namespace diplomat::index {
 		std::size_t dot_pos = path.find('.');
 		// npos => not found
 		if(std::string::npos == dot_pos)
-			return lookup_symbol(std::string(path),true);
+			return lookup_symbol(path,true);
 		else
 		{
 			std::string_view direct_lu = path.substr(0,dot_pos);
@@ -222,7 +227,7 @@ namespace diplomat::index {
 			for(auto& [key, value] : _children)
 			{
 				if(value->_source_range && value->_source_range.value().contains(loc))
-					return value.get();
+					return value;
 			}
 		}
 
@@ -238,18 +243,17 @@ namespace diplomat::index {
 	{
 		for(auto& child : std::views::values(_children))
 			if(child->get_source_range() && child->get_source_range().value() == loc)
-				return child.get();
+				return child;
 
 		return nullptr;
 	}
 
 	IndexScope* IndexScope::get_scope_by_name(const std::string_view& name)
 	{
-		std::string strname(name);
-		if(_children.contains(strname))
-			return _children.at(strname).get();
-		else if (_child_aliases.contains(strname))
-			return _child_aliases.at(strname);
+		if(_children.contains(name))
+			return _children.at(name);
+		else if (_child_aliases.contains(name))
+			return _child_aliases.at(name);
 			
 		return nullptr;
 	}
@@ -257,9 +261,9 @@ namespace diplomat::index {
 	std::string IndexScope::get_full_path() const
 	{
 		if(_parent != nullptr)
-			return _parent->get_full_path() + "." + _name;
+			return fmt::format("{}.{}",_parent->get_full_path(),_name);
 		else
-			return _name;
+			return std::string(_name);
 	}
 
 	std::string IndexScope::get_concrete_path() const 
@@ -274,9 +278,9 @@ namespace diplomat::index {
 		else
 		{
 			if(_parent != nullptr)
-				return _parent->get_concrete_path() + "." + _name;
+				return fmt::format("{}.{}",_parent->get_concrete_path(),_name);
 			else
-				return _name;
+				return std::string(_name);
 		}
 			
 	}
@@ -289,7 +293,7 @@ namespace diplomat::index {
 			ret_holder.insert(this);
 		else
 		{
-			for(auto& child : std::views::values(_children))
+			for(IndexScope* child : std::views::values(_children))
 				child->_build_concrete_children(ret_holder,false);
 		}
 	}
@@ -323,10 +327,18 @@ namespace diplomat::index {
 		#endif
 		{"name",s._name},
 		{"def",s._source_range},
-		{"virtual",s._is_virtual},
-		{"children",s._children}
+		{"virtual",s._is_virtual}
 	};
 
+	nlohmann::json children = nlohmann::json::object();
+
+	for(auto& [key, value] : s._children)
+	{
+		children[key] = *value;
+	}
+
+	j["children"] = children;
+
 	nlohmann::json aliases;
 
 	for(auto& [key, value] : s._child_aliases)
@@ -0,0 +1,266 @@
+#include "index_serializer.hpp"
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+using json = nlohmann::json;
+
+namespace diplomat::index
+{
+	//! Any change of the serialized form shall increment this version.
+	static constexpr int SERIALIZATION_VERSION = 1;
+
+	namespace
+	{
+		/**
+		 * @brief Table of the paths used by the serialized locations.
+		 */
+		class PathTable
+		{
+			std::unordered_map<std::uint32_t, std::size_t> _ids;
+			json _paths = json::array();
+
+		public:
+			std::size_t id(std::uint32_t file_id)
+			{
+				auto [it, inserted] = _ids.try_emplace(file_id, _paths.size());
+				if(inserted)
+					_paths.push_back(FileTable::get_path(file_id).generic_string());
+				return it->second;
+			}
+
+			/**
+			 * @brief Ranges are stored as `[file, line, column, line, column]`, the end file
+			 * being only added, after the start column, if it differs from the start one.
+			 */
+			json range(const IndexRange& range)
+			{
+				json ret = json::array({id(range.start.file_id), range.start.line, range.start.column});
+				if(range.end.file_id != range.start.file_id)
+					ret.push_back(id(range.end.file_id));
+				ret.push_back(range.end.line);
+				ret.push_back(range.end.column);
+				return ret;
+			}
+
+			json range(const std::optional<IndexRange>& range)
+			{
+				return range ? this->range(*range) : json();
+			}
+
+			inline json& paths() {return _paths;};
+		};
+
+		IndexRange read_range(const json& data, const std::vector<std::uint32_t>& file_ids)
+		{
+			const bool other_end_file = data.size() == 6;
+			if(! other_end_file && data.size() != 5)
+				throw std::runtime_error(fmt::format("Invalid serialized range {}", data.dump()));
+
+			IndexRange ret;
+			ret.start.file_id = file_ids.at(data[0].get<std::size_t>());
+			ret.start.line = data[1].get<std::uint32_t>();
+			ret.start.column = data[2].get<std::uint32_t>();
+			ret.end.file_id = other_end_file ? file_ids.at(data[3].get<std::size_t>()) : ret.start.file_id;
+			ret.end.line = data[other_end_file ? 4 : 3].get<std::uint32_t>();
+			ret.end.column = data[other_end_file ? 5 : 4].get<std::uint32_t>();
+			return ret;
+		}
+
+		std::optional<IndexRange> read_optional_range(const json& data, const std::vector<std::uint32_t>& file_ids)
+		{
+			if(data.is_null())
+				return std::nullopt;
+			return read_range(data, file_ids);
+		}
+	}
+
+	void IndexSerializer::_number_scopes(const IndexScope* scope, std::unordered_map<const IndexScope*, std::size_t>& ids, std::vector<const IndexScope*>& order)
+	{
+		ids.emplace(scope, order.size());
+		order.push_back(scope);
+		for(const IndexScope* child : std::views::values(scope->_children))
+			_number_scopes(child, ids, order);
+	}
+
+	/**
+	 * The serialized index holds:
+	 *  - `paths`: all the file paths, refered to by their position.
+	 *  - `files`: for each indexed file, its path and its declared symbols,
+	 *     as `[name, key range, definition range, [reference ranges]]`.
+	 *     Symbols are numbered in order, across all files.
+	 *  - `scopes`: all scopes, parents first, as
+	 *    `[parent, name, virtual, anonymous, unnamed count, range, {alias: scope}, {name: symbol}]`.
+	 *  - `links`: for each indexed file, its scopes, references and additional lookup scopes,
+	 *    which refer to the numbered scopes and symbols.
+	 */
+	json IndexSerializer::save(const IndexCore& index)
+	{
+		PathTable paths;
+
+		std::unordered_map<const IndexSymbol*, std::size_t> symbol_ids;
+		json files = json::array();
+		for(const auto& [path, file] : index._files)
+		{
+			json symbols = json::array();
+			for(const auto& [key, symbol] : file->_declarations)
+			{
+				json refs = json::array();
+				for(const IndexRange& ref : symbol->_references_locations)
+					refs.push_back(paths.range(ref));
+
+				symbol_ids.emplace(symbol, symbol_ids.size());
+				symbols.push_back(json::array({symbol->_name, paths.range(key), paths.range(symbol->_source_range), std::move(refs)}));
+			}
+			files.push_back(json::array({paths.id(file->_file_id), std::move(symbols)}));
+		}
+
+		std::unordered_map<const IndexScope*, std::size_t> scope_ids;
+		std::vector<const IndexScope*> scope_order;
+		if(index._root)
+			_number_scopes(index._root, scope_ids, scope_order);
+
+		json scopes = json::array();
+		for(const IndexScope* scope : scope_order)
+		{
+			json aliases = json::object();
+			for(const auto& [alias, target] : scope->_child_aliases)
+				aliases[alias] = scope_ids.at(target);
+
+			json content = json::object();
+			for(const auto& [name, symbol] : scope->_content)
+			{
+				auto found = symbol_ids.find(symbol);
+				if(found != symbol_ids.end())
+					content[name] = found->second;
+				else
+					spdlog::warn("Symbol {} of scope {} is not declared in any file, not serialized.", name, scope->get_full_path());
+			}
+
+			json parent = scope->_parent ? json(scope_ids.at(scope->_parent)) : json();
+			scopes.push_back(json::array({std::move(parent), scope->_name, scope->_is_virtual, scope->_anonymous,
+				scope->_unnamed_count, paths.range(scope->_source_range), std::move(aliases), std::move(content)}));
+		}
+
+		json links = json::array();
+		for(const auto& [path, file] : index._files)
+		{
+			json file_scopes = json::object();
+			for(const auto& [key, scope] : file->_scopes)
+				file_scopes[key] = scope_ids.at(scope);
+
+			json references = json::array();
+			for(const ReferenceRecord& ref : file->_references)
+				references.push_back(json::array({paths.range(ref.loc), symbol_ids.at(ref.key), ref.is_definition}));
+
+			json lookups = json::object();
+			for(const auto& [key, scope] : file->_additional_lookup_scopes)
+				lookups[key] = scope ? json(scope_ids.at(scope)) : json();
+
+			links.push_back(json::array({std::move(file_scopes), std::move(references), std::move(lookups)}));
+		}
+
+		return json{
+			{"version", SERIALIZATION_VERSION},
+			{"paths", std::move(paths.paths())},
+			{"files", std::move(files)},
+			{"scopes", std::move(scopes)},
+			{"links", std::move(links)}
+		};
+	}
+
+	std::unique_ptr<IndexCore> IndexSerializer::load(const json& data)
+	{
+		if(data.value("version", 0) != SERIALIZATION_VERSION)
+			throw std::runtime_error(fmt::format("Unsupported serialized index version {}", data.value("version", 0)));
+
+		// Paths are interned again, as file IDs are specific to each process.
+		std::vector<std::uint32_t> file_ids;
+		for(const json& path : data.at("paths"))
+			file_ids.push_back(FileTable::get_id(path.get<std::string>()));
+
+		std::unique_ptr<IndexCore> index = std::make_unique<IndexCore>();
+
+		// Symbols first, as both scopes and references point to them.
+		std::vector<IndexFile*> files;
+		std::vector<IndexSymbol*> symbols;
+		for(const json& file_data : data.at("files"))
+		{
+			IndexFile* file = index->add_file_by_id(file_ids.at(file_data.at(0).get<std::size_t>()));
+			files.push_back(file);
+
+			for(const json& symbol_data : file_data.at(1))
+			{
+				IndexSymbol* symbol = index->_arena.create<IndexSymbol>(index->_arena, symbol_data.at(0).get<std::string>());
+				symbol->_source_range = read_optional_range(symbol_data.at(2), file_ids);
+				for(const json& ref : symbol_data.at(3))
+					symbol->_references_locations.insert(read_range(ref, file_ids));
+
+				symbols.push_back(symbol);
+				file->_declarations.emplace(read_range(symbol_data.at(1), file_ids), symbol);
+			}
+		}
+
+		std::vector<IndexScope*> scopes;
+		std::vector<const json*> alias_data;
+		for(const json& scope_data : data.at("scopes"))
+		{
+			const std::string name = scope_data.at(1).get<std::string>();
+			const bool is_virtual = scope_data.at(2).get<bool>();
+
+			IndexScope* scope;
+			if(scope_data.at(0).is_null())
+			{
+				if(index->_root)
+					throw std::runtime_error("Serialized index holds several root scopes");
+				scope = index->set_root_scope(name);
+				scope->_is_virtual = is_virtual;
+			}
+			else
+				scope = scopes.at(scope_data.at(0).get<std::size_t>())->add_child(name, is_virtual);
+
+			scope->_anonymous = scope_data.at(3).get<bool>();
+			scope->_unnamed_count = scope_data.at(4).get<std::size_t>();
+			scope->_source_range = read_optional_range(scope_data.at(5), file_ids);
+			for(const auto& [symbol_name, symbol_id] : scope_data.at(7).items())
+				scope->_content[index->_arena.intern(symbol_name)] = symbols.at(symbol_id.get<std::size_t>());
+
+			scopes.push_back(scope);
+			alias_data.push_back(&scope_data.at(6));
+		}
+
+		// Aliases may point to scopes that are built after the aliasing one.
+		for(std::size_t i = 0; i < scopes.size(); i++)
+		{
+			for(const auto& [alias, scope_id] : alias_data[i]->items())
+				scopes[i]->_child_aliases[index->_arena.intern(alias)] = scopes.at(scope_id.get<std::size_t>());
+		}
+
+		const json& links = data.at("links");
+		if(links.size() != files.size())
+			throw std::runtime_error("Serialized index links do not match the files");
+
+		for(std::size_t i = 0; i < files.size(); i++)
+		{
+			IndexFile* file = files[i];
+			for(const auto& [key, scope_id] : links[i].at(0).items())
+				file->_scopes[key] = scopes.at(scope_id.get<std::size_t>());
+
+			// Saved references have no duplicates, yet they are sorted again once all are loaded.
+			file->_references.reserve(links[i].at(1).size());
+			file->_references_frozen = false;
+			for(const json& ref_data : links[i].at(1))
+				file->_references.emplace_back(read_range(ref_data.at(0), file_ids), symbols.at(ref_data.at(1).get<std::size_t>()), ref_data.at(2).get<bool>());
+
+			for(const auto& [key, scope_id] : links[i].at(2).items())
+				file->_additional_lookup_scopes[key] = scope_id.is_null() ? nullptr : scopes.at(scope_id.get<std::size_t>());
+		}
+
+		index->freeze_references();
+		return index;
+	}
+}
@@ -5,26 +5,23 @@
 namespace diplomat::index 
 {
 
-	IndexSymbol::IndexSymbol(const std::string& name) : 
-		_name(name), _references_locations({}) {}
+	IndexSymbol::IndexSymbol(IndexArena& arena, std::string_view name) : 
+		_name(arena.intern(name)), _references_locations(arena.resource()) {}
 
-	IndexSymbol::IndexSymbol(const std::string& name, const IndexRange& range) : 
-		_name(name), _source_range(range), _references_locations({}) {}
+	IndexSymbol::IndexSymbol(IndexArena& arena, std::string_view name, const IndexRange& range) : 
+		_name(arena.intern(name)), _source_range(range), _references_locations(arena.resource()) {}
 
-	IndexSymbol::IndexSymbol(const std::string_view name, const IndexRange range) : 
-		_name(std::string(name)), _source_range(range) {}
-
-	IndexSymbol::IndexSymbol(const slang::syntax::SyntaxNode& node, const slang::SourceManager& sm) :
-		_name(node.getFirstToken().rawText()),
+	IndexSymbol::IndexSymbol(IndexArena& arena, const slang::syntax::SyntaxNode& node, const slang::SourceManager& sm) :
+		_name(arena.intern(node.getFirstToken().rawText())),
 		_source_range({node,sm}),
-		_references_locations({})
+		_references_locations(arena.resource())
 	{}
 
 
-	IndexSymbol::IndexSymbol(const slang::ast::Symbol& node, const slang::SourceManager& sm) :
-		_name(node.name),
+	IndexSymbol::IndexSymbol(IndexArena& arena, const slang::ast::Symbol& node, const slang::SourceManager& sm) :
+		_name(arena.intern(node.name)),
 		_source_range({node,sm}),
-		_references_locations({})
+		_references_locations(arena.resource())
 	{}
 
 
@@ -64,10 +61,3 @@ void diplomat::index::to_json(nlohmann::json &j, const IndexSymbol *&s)
 		{"refs",s->_references_locations}
 	};
 }
-
-void diplomat::index::from_json(const nlohmann::json &j, IndexSymbol &s)
-{
-	JSON_TO_STRUCT_SAFE_BIND(j,"id",s._name);
-	JSON_TO_STRUCT_SAFE_BIND(j,"loc",s._source_range);
-	JSON_TO_STRUCT_SAFE_BIND(j,"refs",s._references_locations);
-}
@@ -277,7 +277,7 @@ namespace diplomat::index {
 		if(stx)
 		{
 			IndexRange import_source = IndexRange(stx->sourceRange(),*_sm);
-			IndexFile* containing_file = _index->add_file(import_source.start.file);
+			IndexFile* containing_file = _index->add_file_by_id(import_source.start.file_id);
 
 
 			containing_file->record_additionnal_lookup_scope(std::string(node.packageName));
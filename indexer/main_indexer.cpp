@@ -100,31 +100,22 @@ int main(int argc, char** argv) {
    
     std::unique_ptr<diplomat::index::IndexCore> index = std::move(indexer.get_index());
 
-    for(const auto& file : index->get_indexed_files())
+    if(cst_dump_file)
     {
+        for(const auto& file : index->get_indexed_files())
         {
-            spdlog::info("Processing references for {}",file->get_path().generic_string());
-
-            auto stx = file->get_syntax_root();
-            if(stx)
+            if(file->get_path() == std::filesystem::weakly_canonical(cst_dump_file.value()))
             {
-                diplomat::index::ReferenceVisitor ref_visitor(compilation->getSourceManager(),index.get());
-                stx->visit(ref_visitor);
+                print_slang_cst(file->get_syntax_root());
+                return 0;
             }
-
-            if(cst_dump_file)
-            {
-                if(file->get_path() == std::filesystem::weakly_canonical(cst_dump_file.value()))
-                {
-                    print_slang_cst(stx);
-                    return 0;
-                }
-            }
-
-            
         }
     }
 
+    // Reference resolution uses as many threads as the analysis (--threads).
+    index->process_references(*compilation->getSourceManager(), driver.options.numThreads.value_or(0));
+    index->freeze_references();
+
     spdlog::info("Analysis done in {:.6} !",sw);
 
     // Need to re-run because the files are filled out of order dur to the use of the syntax node.
@@ -4,6 +4,8 @@
 #include "slang/diagnostics/DiagnosticClient.h"
 #include "slang/diagnostics/DiagnosticEngine.h"
 #include "diplomat_document_cache.hpp"
+#include "nlohmann/json.hpp"
+#include <cstdint>
 #include <unordered_map>
 #include <memory>
 #include <string>
@@ -18,6 +20,12 @@ namespace slsp
             slsp::types::PublishDiagnosticsParams* _last_publication;
             const slang::SourceManager* _sm;
 
+            /**
+             * @brief Hash of the diagnostic set of each URI, as returned by #diagnostics_hash.
+             * Entries are dropped whenever the diagnostics of their URI are modified.
+             */
+            std::unordered_map<std::string, std::uint64_t> _hashes;
+
             void _remap_internal_diagnostic_uri(slsp::types::PublishDiagnosticsParams* diag, const std::string& old_uri, const std::string& new_uri);
         public:
 	        //LSPDiagnosticClient(const sv_doclist_t& doc_list, const slang::SourceManager* sm);
@@ -29,6 +37,48 @@ namespace slsp
             void report_new_diagnostic(const slang::ReportedDiagnostic& to_report);
             void report_related_diagnostic(const slang::ReportedDiagnostic& to_report);
             bool remap_diagnostic_uri(const std::string& orig_uri, const std::string& new_uri);
+
+            /**
+             * @brief Replace the lexer, preprocessor and parser diagnostics of a document,
+             * keeping the other ones.
+             * 
+             * @param uri Document to update.
+             * @param syntax_diags New syntax diagnostics of the document.
+             */
+            void replace_syntax_diagnostics(const std::string& uri, std::vector<slsp::types::Diagnostic> syntax_diags);
+
+            /**
+             * @brief Check if a diagnostic built by this client comes from the lexer, 
+             * the preprocessor or the parser.
+             */
+            static bool is_syntax_diagnostic(const slsp::types::Diagnostic& diag);
+
+            /**
+             * @brief Number of diagnostics held for each URI.
+             */
+            std::unordered_map<std::string, std::size_t> count_diagnostics() const;
+
+            /**
+             * @brief Export the diagnostics, to be added to another client by #append_diagnostics.
+             * 
+             * @param skip Number of diagnostics to leave out for each URI, as returned by
+             * #count_diagnostics, to only export the ones reported since.
+             * @return JSON object holding the list of diagnostics of each URI.
+             */
+            nlohmann::json export_diagnostics(const std::unordered_map<std::string, std::size_t>& skip = {}) const;
+
+            /**
+             * @brief Add diagnostics exported by #export_diagnostics to the ones of this client.
+             */
+            void append_diagnostics(const nlohmann::json& diagnostics);
+
+            /**
+             * @brief Hash of the diagnostics of a URI, used to detect changes between publications.
+             * The hash is only computed once after the diagnostics of the URI are modified.
+             * 
+             * @param uri URI to hash the diagnostics of, which shall be held by the client.
+             */
+            std::uint64_t diagnostics_hash(const std::string& uri);
             inline const std::unordered_map<std::string, std::unique_ptr<slsp::types::PublishDiagnosticsParams> >& get_publish_requests() const {return _diagnostics; };
     };
 
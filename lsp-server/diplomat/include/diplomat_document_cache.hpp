@@ -5,16 +5,48 @@
 #include "slang/text/SourceManager.h"
 #include "uri.hh"
 #include "visitor_module_bb.hpp"
+#include "syntax_tree_cache.hpp"
+
+#include "nlohmann/json.hpp"
 
 #include <memory>
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <filesystem>
+#include <optional>
 #include <set>
+#include <vector>
 
 #include <unordered_map>
 namespace diplomat::cache
 {
+    /**
+     * @brief Record of the persistent blackbox cache, for a single file.
+     * The blackboxes are reused as long as the file size and either the modification 
+     * time or the content hash are unchanged.
+     */
+    struct DiskCacheEntry
+    {
+        std::uintmax_t size;
+        std::int64_t mtime;
+        std::uint64_t hash;
+        nlohmann::json blackboxes;
+    };
+
+    /**
+     * @brief State of a file when it was read, used to build a DiskCacheEntry.
+     * The size and modification time are taken before reading the file, and the hash
+     * is the one of the content actually parsed.
+     */
+    struct DiskStamp
+    {
+        std::uintmax_t size;
+        std::int64_t mtime;
+        std::uint64_t hash;
+    };
+
     /**
      * @brief This class aim to handle store high-level files informations.
      * This means the associations file <-> modules, blackboxes and so on.
@@ -25,6 +57,9 @@ namespace diplomat::cache
     class DiplomatDocumentCache
     {
         protected : 
+            //! Blackboxes read from a single file, by module name.
+            using bb_map_t = std::unordered_map<std::string,std::unique_ptr<ModuleBlackBox>>;
+
             //! Its very own source manager as to not pollute the actual LSP SM.
             //! If a batch read is made, it should be possible to discard it.
             std::unique_ptr<slang::SourceManager> _sm;
@@ -65,6 +100,35 @@ namespace diplomat::cache
              */
             std::pair<std::string, std::string> _ws_path_mapping;
 
+            //! Persistent cache records, by standardized path.
+            std::unordered_map<std::filesystem::path, DiskCacheEntry> _disk_entries;
+
+            //! Set when #_disk_entries has been modified since the last load or save.
+            bool _disk_cache_dirty = false;
+
+            //! Shared tree store, used for the files that will be compiled.
+            SyntaxTreeCache* _tree_store = nullptr;
+            //! Set when the whole workspace is compiled, not only the project files.
+            bool _store_workspace = false;
+
+            /**
+             * @brief Check if the syntax tree of a file shall be taken from the shared store.
+             * This is the case for the files that will be compiled anyway.
+             */
+            inline bool _use_tree_store(bool in_prj) const
+            {return _tree_store && (in_prj || _store_workspace);};
+
+            /**
+             * @brief Extract the blackboxes from the shared store trees.
+             * 
+             * @param store Tree store to read the files from.
+             * @param fpaths Files to process.
+             * @param read_bb Output, blackboxes of each file (nullptr if it could not be read).
+             * @param stamps Output, stamp of each file (nothing for the in-memory contents).
+             */
+            static void _extract_from_store(SyntaxTreeCache& store, const std::vector<std::filesystem::path>& fpaths, 
+                std::vector<std::unique_ptr<bb_map_t>>& read_bb, std::vector<std::optional<DiskStamp>>& stamps);
+
             /**
              * @brief Low level function to bind a blackbox to its file path. 
              * 
@@ -72,12 +136,124 @@ namespace diplomat::cache
              * @param bb Blackbox to record
              */
              void _bind_bb_and_path(const std::filesystem::path& fpath, const ModuleBlackBox* bb);
+
+            /**
+             * @brief First step of the processing of a file: check if the file requires
+             * to be (re)parsed and cleanup the outdated records if needed.
+             * 
+             * @param fpath File to process
+             * @param in_prj Project status of the file, updated if the file was already recorded.
+             * @return The standardized path of the file if it shall be parsed, nothing otherwise.
+             */
+            std::optional<std::filesystem::path> _prepare_processing(const std::filesystem::path& fpath, bool& in_prj);
+
+            /**
+             * @brief Last step of the processing of a file: store the blackboxes read from
+             * the file and record the file.
+             * 
+             * @param fpath Standardized path of the file, as returned by _prepare_processing
+             * @param read_bb Blackboxes read from the file.
+             * @param in_prj Project status of the file
+             * @param stamp Stamp of the file when read, nothing to not update the persistent cache.
+             */
+            void _store_blackboxes(const std::filesystem::path& fpath, bb_map_t& read_bb, bool in_prj, const std::optional<DiskStamp>& stamp);
+
+            /**
+             * @brief Read a file and extract its blackboxes.
+             * The header-only prescan is tried first, with a fallback to the full syntax tree.
+             * 
+             * @param fpath File to read
+             * @param sm Source manager to use for the file
+             * @param stamp Output, stamp of the file taken before reading it, with the hash of the read content.
+             * @return The read blackboxes, or nullptr if the file could not be read.
+             */
+            static std::unique_ptr<bb_map_t> _extract_blackboxes(const std::filesystem::path& fpath, slang::SourceManager& sm, DiskStamp& stamp);
+
+            /**
+             * @brief Read the size and modification time of a file, the hash is left untouched.
+             * 
+             * @return false if the file could not be accessed.
+             */
+            static bool _read_disk_stamp(const std::filesystem::path& fpath, DiskStamp& stamp);
+
+            /**
+             * @brief Lookup the persistent cache for a file.
+             * 
+             * @param fpath Standardized path of the file
+             * @return The blackboxes of the file if the cache record is still valid, nullptr otherwise.
+             */
+            std::unique_ptr<bb_map_t> _lookup_disk_cache(const std::filesystem::path& fpath);
+
+            /**
+             * @brief Update the persistent cache record of a file.
+             * The record is dropped instead if the file changed since \p stamp was taken.
+             */
+            void _record_disk_entry(const std::filesystem::path& fpath, const bb_map_t& read_bb, const DiskStamp& stamp);
              
              public : 
 
              //DiplomatDocumentCache();
+
+            /**
+             * @brief Files selected by #prepare_files, to be parsed by #extract_files 
+             * and then recorded by #merge_files.
+             */
+            struct FileBatch
+            {
+                struct Task
+                {
+                    std::filesystem::path path;
+                    bool in_prj;
+                    //! Set if the file is taken from the tree store.
+                    bool from_store;
+                    std::unique_ptr<bb_map_t> read_bb;
+                    std::optional<DiskStamp> stamp;
+                };
+
+                std::vector<Task> tasks;
+                //! Files that resolve to an already queued path (links, for example),
+                //! only recorded once the queued one is stored.
+                std::vector<std::pair<std::filesystem::path, bool>> deferred_records;
+                //! Tree store to use for the tasks flagged as such.
+                SyntaxTreeCache* tree_store = nullptr;
+            };
+
+            /**
+             * @brief Hash function used to detect content changes (64 bits FNV-1a).
+             */
+            static std::uint64_t hash_content(std::string_view content);
+
+            /**
+             * @brief Hash the whole content of a file with {@link hash_content}
+             * 
+             * @return The hash, or nothing if the file could not be read.
+             */
+            static std::optional<std::uint64_t> hash_file(const std::filesystem::path& fpath);
+
+            /**
+             * @brief Load the persistent blackbox cache.
+             * Records are only used when the matching file is processed.
+             * 
+             * @param cache_file Cache file to read
+             * @param version Version tag, the cache is discarded if it does not match.
+             * @return true if the cache has been loaded.
+             */
+            bool load_disk_cache(const std::filesystem::path& cache_file, const std::string& version);
+
+            /**
+             * @brief Save the persistent blackbox cache, if modified.
+             * 
+             * @param cache_file Cache file to write
+             * @param version Version tag to record.
+             * @return true if the cache file is up to date.
+             */
+            bool save_disk_cache(const std::filesystem::path& cache_file, const std::string& version);
              
              void set_workspace_root(uri& path);
+
+             //! Workspace root, as given by the client.
+             inline const std::string& get_workspace_root() const {return _ws_path_mapping.second;};
+
              std::filesystem::path standardize_path(const std::filesystem::path& fpath) const; 
              std::filesystem::path standardize_path(const std::string& fpath) const; 
              std::filesystem::path standardize_path(const uri& fpath) const; 
@@ -224,6 +400,58 @@ namespace diplomat::cache
 
             void process_file(const uri& uri, const bool in_prj = false);
 
+            /**
+             * @brief Process a list of files, parsing them in parallel.
+             * 
+             * The result is the same as calling {@link process_file} on each file in order:
+             * The files that need to be parsed are selected first, then parsed in parallel
+             * (each with its own source manager) and the results are finally recorded 
+             * in the order of \p fpaths.
+             * 
+             * @param fpaths Files to process
+             * @param in_prj If the files are to be recorded, record them in the project
+             * @param threads Number of threads to use, 0 to use all available cores.
+             */
+            void process_files(const std::vector<std::filesystem::path>& fpaths, bool in_prj = false, unsigned int threads = 0);
+
+            /**
+             * @brief First step of {@link process_files}: select the files that need to be parsed.
+             * Outdated records are removed, and files found in the persistent cache are recorded.
+             * 
+             * @param fpaths Files to process
+             * @param in_prj If the files are to be recorded, record them in the project
+             * @return The files to parse.
+             */
+            FileBatch prepare_files(const std::vector<std::filesystem::path>& fpaths, bool in_prj = false);
+
+            /**
+             * @brief Second step of {@link process_files}: parse the selected files.
+             * The cache is not accessed, so that this step may run along readers of the cache.
+             * 
+             * @param batch Files to parse, as returned by #prepare_files.
+             * @param threads Number of threads to use, 0 to use all available cores.
+             */
+            static void extract_files(FileBatch& batch, unsigned int threads = 0);
+
+            /**
+             * @brief Last step of {@link process_files}: record the parsed files, in order.
+             * Files processed by another call since #prepare_files are left as they are.
+             * 
+             * @param batch Files parsed by #extract_files.
+             */
+            void merge_files(FileBatch& batch);
+
+            /**
+             * @brief Use a shared tree store for the files that are compiled, instead of 
+             * scanning them on their own. The same trees are then used by the compilation.
+             * 
+             * @param store Store to use, nullptr to disable.
+             * @param whole_workspace Set if all workspace files are compiled, otherwise only 
+             * the project files use the store.
+             */
+            inline void set_tree_store(SyntaxTreeCache* store, bool whole_workspace)
+            {_tree_store = store; _store_workspace = whole_workspace;};
+
             /**
              * @brief Attempt to match an URI with a recorded file in order to fill 
              * {@link _doc_path_to_client_uri} .
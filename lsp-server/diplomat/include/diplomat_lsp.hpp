@@ -5,6 +5,9 @@
 #include "diagnostic_client.hpp"
 #include "diplomat_lsp_ws_settings.hpp"
 #include "diplomat_document_cache.hpp"
+#include "workspace_watcher.hpp"
+#include "syntax_tree_cache.hpp"
+#include "document_buffer.hpp"
 // #include "diplomat_index.hpp"
 
 
@@ -14,14 +17,25 @@
 
 
 #include "slang/ast/Compilation.h"
+#include "slang/analysis/AnalysisOptions.h"
 #include "slang/diagnostics/DiagnosticEngine.h"
 #include "visitor_module_bb.hpp"
 
 #include <iostream>
+#include <set>
 #include <unordered_set>
+#include <unordered_map>
+#include <optional>
 #include <memory>
 #include <filesystem>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <sys/types.h>
 
 
 
@@ -37,11 +51,14 @@ class DiplomatLSP : public slsp::BaseLSP
         void _h_didChangeWorkspaceFolders(json params);
         void _h_didSaveTextDocument(slsp::types::DidSaveTextDocumentParams params);
         void _h_didOpenTextDocument(json params);
+        void _h_didChangeTextDocument(json params);
         void _h_didCloseTextDocument(slsp::types::DidCloseTextDocumentParams params);
         json _h_completion(slsp::types::CompletionParams params);
         json _h_formatting(slsp::types::DocumentFormattingParams params);
         json _h_gotoDefinition(slsp::types::DefinitionParams params);
         json _h_references(json params);
+        json _h_document_diagnostic(json params);
+        json _h_workspace_diagnostic(json params);
         json _h_rename(json params);
         void _h_exit(json params);
         json _h_initialize(slsp::types::InitializeParams params);
@@ -75,13 +92,63 @@ class DiplomatLSP : public slsp::BaseLSP
         void _cleanup_diagnostics();
 
         void _emit_diagnostics();
+        void _emit_diagnostics(const std::string& key);
+        bool _emit_uri_diagnostics(const std::string& key, const slsp::types::PublishDiagnosticsParams& pub);
         void _erase_diagnostics();
 
+        /**
+         * @brief Parse a single document and publish its syntax diagnostics, 
+         * without waiting for the next compilation.
+         * 
+         * @param path Standardized path of the document.
+         * @param content Current content of the document.
+         */
+        void _publish_syntax_diagnostics(const std::filesystem::path& path, const std::string& content);
+
+        /**
+         * @brief Get the key of a document in the published diagnostics, from a client URI.
+         */
+        std::string _diagnostic_uri(const std::string& client_uri) const;
+
+        /**
+         * @brief Build the diagnostic report of a document, for pull diagnostics.
+         * 
+         * @param doc_uri Document URI, as per #_diagnostic_uri
+         * @param previous_id Result ID known by the client, if any.
+         * @return `unchanged` report if \p previous_id is still valid, `full` report otherwise.
+         */
+        json _diagnostic_report(const std::string& doc_uri, const std::optional<std::string>& previous_id) const;
+
         // SVDocument* _read_document(std::filesystem::path path);
 
-        std::unique_ptr<slang::SourceManager> _sm;
+        std::shared_ptr<slang::SourceManager> _sm;
+
+        //! Syntax trees kept between compilations, shared with #_cache.
+        diplomat::cache::SyntaxTreeCache _tree_cache;
+
+        //! Request the compilation thread to drop #_tree_cache.
+        std::atomic<bool> _reset_tree_cache;
 
         diplomat::cache::DiplomatDocumentCache _cache;
+
+        //! Reports the workspace files modifications, to keep #_cache up to date.
+        diplomat::cache::WorkspaceWatcher _ws_watcher;
+
+        //! Content of the documents opened in the client, by standardized path.
+        std::unordered_map<std::filesystem::path, diplomat::cache::DocumentBuffer> _open_documents;
+        //! Opened documents modified since they were last given to #_tree_cache.
+        std::unordered_set<std::filesystem::path> _unsynced_documents;
+
+        /**
+         * @brief Give the content of the modified opened documents to #_tree_cache, 
+         * to be used instead of the files on the disk.
+         */
+        void _sync_open_documents();
+
+        /**
+         * @brief Include directories of the design, in lookup order.
+         */
+        std::vector<std::string> _include_dirs() const;
        
         std::vector< std::filesystem::path> _root_dirs;
         std::unordered_set< std::filesystem::path> _excluded_paths;
@@ -98,17 +165,73 @@ class DiplomatLSP : public slsp::BaseLSP
 
         std::shared_ptr<slsp::LSPDiagnosticClient> _diagnostic_client;
 
-        std::unique_ptr<diplomat::index::IndexCore> _index;
-
+        //! Hash of the last diagnostics published for each URI, kept across compilations.
+        std::unordered_map<std::string, std::uint64_t> _published_diag_hashes;
+        //! Number of diagnostic publications skipped as unchanged.
+        std::uint64_t _skipped_diag_publications;
+
+        //! Set when the client pulls the diagnostics (LSP 3.17) instead of receiving them.
+        bool _pull_diagnostics;
+        //! Set when the client may be requested to pull the diagnostics again.
+        bool _diag_refresh_support;
+
+        /**
+         * @brief Current index snapshot.
+         * 
+         * The index is never modified once published. Readers shall take a copy
+         * of the pointer through #_get_index() and use it for the whole request, 
+         * so that a new snapshot may be swapped in while they run.
+         */
+        std::shared_ptr<diplomat::index::IndexCore> _index;
+        std::mutex _index_access;
+
+        /**
+         * @brief Protects the server state (cache, settings, compilation...).
+         * 
+         * Requests flagged as concurrent hold it shared, all other handlers
+         * hold it exclusively.
+         * The background compilation only holds it while reading its inputs 
+         * and while publishing its results.
+         */
+        std::shared_mutex _state_access;
 
         bool _project_file_tree_valid;
 
+        //! Set once the persistent blackbox cache has been loaded.
+        bool _disk_cache_loaded;
+
+        //! Set when the cache reflects a full workspace scan, and is kept up to date by #_ws_watcher.
+        //! Shall be reset on any change of the workspace folders, exclusions or extensions.
+        bool _ws_scan_valid;
+
         bool _watch_client_pid;
-        bool _broken_index_emitted;
+        std::atomic<bool> _broken_index_emitted;
         std::jthread _pid_watcher;
 
-        std::unique_ptr<slang::ast::Compilation> _compilation;
+        //! Design hierarchy, captured from the last compilation which is not kept.
+        json _design_hierarchy;
         std::unique_ptr<slang::SourceLibrary> _default_source_lib;
+
+        std::mutex _compile_access;
+        std::condition_variable_any _compile_cv;
+        bool _compile_requested;
+
+        /**
+         * @brief Incremented on each compilation request.
+         * A running compilation whose generation is not the last one is superseded
+         * and will be abandoned at the next phase boundary.
+         */
+        std::atomic<std::uint64_t> _compile_generation;
+
+        //! In a compilation child process, pipe to send the results to the server process.
+        //! Set to -1 in the server process.
+        int _compile_worker_fd;
+
+        /**
+         * @brief Delay without new request to wait before starting a compilation.
+         * Allows merging requests issued in a quick succession (save all, for example).
+         */
+        static constexpr std::chrono::milliseconds _compile_debounce = std::chrono::milliseconds(250);
         
 
         slsp::types::Location _slang_to_lsp_location(const slang::SourceRange& sr) const;
@@ -122,17 +245,185 @@ class DiplomatLSP : public slsp::BaseLSP
         void _add_workspace_folders(const std::vector<slsp::types::WorkspaceFolder>& to_add);
         void _remove_workspace_folders(const std::vector<slsp::types::WorkspaceFolder>& to_rm);
 
-        void _read_workspace_modules();
-        void _read_filetree_modules();
-        void _compile();
+        diplomat::cache::DiplomatDocumentCache::FileBatch _read_workspace_modules();
+
+        /**
+         * @brief Bring the cache up to date with the workspace.
+         * When the workspace is watched, only the files reported as modified are processed.
+         * Otherwise, the whole workspace is scanned (see {@link _read_workspace_modules}) and
+         * the watch is (re)started.
+         */
+        void _sync_workspace_modules();
+
+        /**
+         * @brief First step of #_sync_workspace_modules: select the files to parse.
+         * They may then be parsed without holding #_state_access, 
+         * see DiplomatDocumentCache::extract_files.
+         * 
+         * @return Files to parse, to be given to #_merge_workspace_modules.
+         */
+        diplomat::cache::DiplomatDocumentCache::FileBatch _prepare_workspace_modules();
+
+        /**
+         * @brief Last step of #_sync_workspace_modules: record the parsed files
+         * and update the persistent cache.
+         */
+        void _merge_workspace_modules(diplomat::cache::DiplomatDocumentCache::FileBatch& batch);
+
+        /**
+         * @brief Apply the modifications reported by the workspace watcher.
+         * Removed files are dropped from the cache right away.
+         * 
+         * @param batch Set to the modified files to parse.
+         * @return false if some events were lost, in which case a full scan is required.
+         */
+        bool _apply_workspace_events(diplomat::cache::DiplomatDocumentCache::FileBatch& batch);
+
+        /**
+         * @brief Get the path of the persistent blackbox cache for the current workspace.
+         * It is located in `$XDG_CACHE_HOME/diplomat` (or `~/.cache/diplomat`) and named after
+         * the hash of the workspace directories.
+         * 
+         * @return The cache file path, or nothing if it can't be determined.
+         */
+        std::optional<std::filesystem::path> _disk_cache_path() const;
+
+        /**
+         * @brief Version tag of the persistent cache, any mismatch discards the cache.
+         */
+        static std::string _disk_cache_version();
+        diplomat::cache::DiplomatDocumentCache::FileBatch _read_filetree_modules();
+
+        /**
+         * @brief Performs all steps of the compilation and elaboration of the design, 
+         * including diagnostic emission.
+         * 
+         * @param generation Generation of this compilation, as per #_compile_generation
+         * @return true if the compilation was fully done, false if it was superseded.
+         */
+        bool _compile(std::uint64_t generation);
+
+        /**
+         * @brief Parse, elaborate, index and analyse the design, then publish the results.
+         * Run by #_compile once its inputs are gathered, either in the server or in a
+         * compilation child process.
+         * 
+         * @param generation Generation of this compilation, as per #_compile_generation
+         * @param files Files to compile, in order.
+         * @param coptions Compilation options.
+         * @param aoptions Analysis options.
+         * @param parse_threads Number of threads of the per-file passes (parsing, index references), 0 for all cores.
+         * @param defer_analysis Publish the compilation before running the analysis.
+         * @return true if the compilation was fully done, false if it was superseded.
+         */
+        bool _compile_design(std::uint64_t generation, 
+            const std::vector<std::filesystem::path>& files, 
+            const slang::ast::CompilationOptions& coptions, 
+            const slang::analysis::AnalysisOptions& aoptions,
+            unsigned int parse_threads,
+            bool defer_analysis);
+
+        /**
+         * @brief Start a compilation child process, see #run_compile_worker, and send it its job.
+         * 
+         * @param job Inputs of the compilation, as read by #_run_compile_job.
+         * @param read_fd Set to the read end of the pipe from the child process.
+         * @return PID of the child process, -1 on failure.
+         */
+        pid_t _spawn_compile_worker(const json& job, int& read_fd);
+
+        /**
+         * @brief In a compilation child process, setup the state from the job sent by the server,
+         * then run #_compile_design.
+         */
+        void _run_compile_job(const json& job);
+
+        /**
+         * @brief Receive and publish the results of a compilation child process.
+         * The child process is killed as soon as the compilation is superseded.
+         * 
+         * @param generation Generation of the compilation.
+         * @param pid PID of the child process.
+         * @param fd Read end of the pipe from the child process, closed on return.
+         * @param memory_limit Limit of the resident memory of the child process, in MiB, 0 for no limit.
+         * @return true if the compilation was fully done, false if it was superseded.
+         * @throws std::runtime_error if the child process failed.
+         */
+        bool _await_compile_worker(std::uint64_t generation, pid_t pid, int fd, unsigned int memory_limit);
+
+        /**
+         * @brief In a compilation child process, send a message to the server process.
+         */
+        void _send_to_server(const json& message);
+
+        /**
+         * @brief Lock #_state_access shared, as the compilation needs it when looking up the cache.
+         * In a compilation child process, which has no concurrent access, nothing is locked.
+         */
+        std::shared_lock<std::shared_mutex> _shared_state_lock();
+
+        /**
+         * @brief Make the result of a compilation the current one, and publish its diagnostics.
+         * 
+         * @param generation Generation of the compilation, nothing is done if it is superseded.
+         * @param hierarchy Design hierarchy of the compilation, as built by HierVisitor.
+         * @param sm Source manager of the compilation.
+         * @param diagnostic_client Client holding the compilation diagnostics.
+         * @param index Index built from the compilation.
+         * @return true if published, false if superseded.
+         */
+        bool _publish_compilation(std::uint64_t generation, 
+            json hierarchy, 
+            const std::shared_ptr<slang::SourceManager>& sm, 
+            const std::shared_ptr<slsp::LSPDiagnosticClient>& diagnostic_client, 
+            std::shared_ptr<diplomat::index::IndexCore> index);
+
+        /**
+         * @brief Check if the compilation of the given generation shall be abandoned, 
+         * either because a newer one has been requested or because the server is stopping.
+         */
+        bool _is_superseded(std::uint64_t generation) const;
+
+        /**
+         * @brief Ask for a compilation of the design by the background compilation thread.
+         * Returns immediately.
+         */
+        void _request_compile();
+
+        /**
+         * @brief Background compilation thread function.
+         * 
+         * @param stok Stop token used to exit the thread
+         */
+        void _compile_loop(std::stop_token stok);
+
+        std::shared_ptr<diplomat::index::IndexCore> _get_index();
+        void _set_index(std::shared_ptr<diplomat::index::IndexCore> new_index);
+
+        DiplomatLSP(std::istream& is, std::ostream& os, bool watch_client_pid, int compile_worker_fd);
                 
         void _save_client_uri(const std::string& client_uri);
 
-        bool _assert_index(bool always_throw = false);
+        bool _assert_index(const diplomat::index::IndexCore* index, bool always_throw = false);
+
+        json _invoke_request(const std::string& fct_name, json& args) override;
+        void _invoke_notif(const std::string& fct_name, json& args) override;
+        void _run_callback(const std::string& id, json& args) override;
 
         void _compute_project_tree(bool keep_tree = true);
         void _clear_project_tree();
-        void _add_module_to_project_tree(const std::string& mod);
+
+        /**
+         * @brief List the files of the project tree, from the top level module.
+         * @return Files to give to #_record_project_tree.
+         */
+        std::set<std::filesystem::path> _list_project_tree(const std::string& top) const;
+
+        /**
+         * @brief Add the listed files to the project, which is then valid.
+         */
+        void _record_project_tree(const std::set<std::filesystem::path>& files);
+        void _add_module_to_project_tree(const std::string& mod, std::set<std::filesystem::path>& files, std::unordered_set<std::string>& modules) const;
 
         // const SVDocument* _document_from_module(const std::string& module) const;
         const ModuleBlackBox* _bb_from_module(const std::string& module) const;
@@ -141,7 +432,17 @@ class DiplomatLSP : public slsp::BaseLSP
     public:
         explicit DiplomatLSP(std::istream& is = std::cin, std::ostream& os = std::cout, bool watch_client_pid = true);
 
-        slang::ast::Compilation* get_compilation();
+        //! Command line flag that starts the server executable as a compilation process.
+        static constexpr const char* compile_worker_flag = "--compile-worker";
+
+        /**
+         * @brief Entry point of a compilation child process, started by the server with
+         * #compile_worker_flag. The job is read from the standard input.
+         * 
+         * @return Exit code of the process.
+         */
+        static int run_compile_worker();
+
         // inline const std::unordered_map<std::filesystem::path, std::unique_ptr<SVDocument>>& get_documents() const {return _documents;};
         
         //void read_config(std::filesystem::path& filepath);
@@ -152,4 +453,11 @@ class DiplomatLSP : public slsp::BaseLSP
 
         inline void set_watch_client_pid(bool new_value) {_watch_client_pid = new_value;};
 
+    protected:
+        /**
+         * @brief Background compilation thread.
+         * 
+         * @note Declared last to be stopped and joined before any other member is destroyed.
+         */
+        std::jthread _compile_worker;
 };
\ No newline at end of file
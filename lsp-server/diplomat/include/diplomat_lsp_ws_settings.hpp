@@ -41,7 +41,32 @@ namespace slsp
 
 		DiplomatLSPIncludeDirs includes;
 
+		//! Number of threads used to parse the files and to resolve the index references, 
+		//! 0 to use all available cores.
+		unsigned int parse_threads = 0;
+
+		//! Number of threads used by the design analysis, 0 to use all available cores.
+		unsigned int analysis_threads = 0;
+
+		//! If set, compilation diagnostics are published before running the analysis,
+		//! and analysis diagnostics follow in a second publication.
+		bool defer_analysis = false;
+
+		//! If set, the design is compiled and indexed in a child process, 
+		//! which only sends back the results.
+		bool compile_in_subprocess = false;
+
+		//! Resident memory limit of the compilation child process, in MiB, 0 for no limit.
+		//! The child process is killed once it goes over the limit.
+		unsigned int compile_memory_limit = 0;
+
 		void refresh_regexs();
+
+		/**
+		 * @brief Check if a (standardized) path is excluded from the workspace, 
+		 * either explicitely or through an exclusion pattern.
+		 */
+		bool is_excluded(const std::string& path) const;
 	};
 	
 	void to_json(nlohmann::json& j, const SlangDiagDesignator& s);
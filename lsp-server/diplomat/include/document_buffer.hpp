@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace diplomat::cache
+{
+    /**
+     * @brief In-memory content of a document opened by the client.
+     *
+     * Edits are stored in a piece table: the original content and all inserted text are kept
+     * in two append-only buffers, and the document is described by a list of pieces pointing
+     * to them. An edit only splits and drops pieces, without moving the text around.
+     *
+     * Positions follow the LSP conventions: zero-based lines separated by `\n`,
+     * and columns in UTF-16 code units.
+     */
+    class DocumentBuffer
+    {
+        public:
+            explicit DocumentBuffer(std::string content = "", int version = 0);
+
+            /**
+             * @brief Replace the whole content of the document.
+             */
+            void replace(std::string content, int version);
+
+            /**
+             * @brief Replace a range of the document by a new text.
+             * Positions past the end of a line, or of the document, are clamped.
+             *
+             * @param start_line Start line of the range.
+             * @param start_char Start column of the range.
+             * @param end_line End line of the range (excluded).
+             * @param end_char End column of the range (excluded).
+             * @param text Text to insert in place of the range.
+             * @param version New version of the document.
+             */
+            void apply_change(unsigned int start_line, unsigned int start_char,
+                unsigned int end_line, unsigned int end_char, std::string_view text, int version);
+
+            /**
+             * @brief Build the full content of the document.
+             */
+            std::string text() const;
+
+            inline std::size_t size() const {return _size;};
+            inline int version() const {return _version;};
+            inline std::size_t piece_count() const {return _pieces.size();};
+
+        protected:
+            struct Piece
+            {
+                //! Set if the piece points to #_added, otherwise to #_original
+                bool added;
+                std::size_t start;
+                std::size_t length;
+                //! Number of line feeds in the piece.
+                std::size_t newlines;
+            };
+
+            std::string _original;
+            std::string _added;
+            std::vector<Piece> _pieces;
+            std::size_t _size;
+            int _version;
+
+            std::string_view _view(const Piece& piece) const;
+
+            /**
+             * @brief Convert a LSP position to a byte offset in the document.
+             */
+            std::size_t _offset_of(unsigned int line, unsigned int character) const;
+
+            /**
+             * @brief Make sure that a piece starts at \p offset.
+             * @return Index of the piece starting at \p offset, or the number of pieces at the end.
+             */
+            std::size_t _split(std::size_t offset);
+
+            void _erase(std::size_t offset, std::size_t length);
+            void _insert(std::size_t offset, std::string_view text);
+
+            /**
+             * @brief Merge all pieces back into a single original buffer.
+             */
+            void _compact();
+    };
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "visitor_module_bb.hpp"
+#include "slang/text/SourceManager.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @brief Extract the module blackboxes of a source buffer without parsing the module bodies.
+ *
+ * Module headers are parsed by slang, as for {@link VisitorModuleBlackBox}, while the bodies only
+ * go through the preprocessor and lexer to collect the instantiated module types.
+ *
+ * The prescan gives up as soon as it meets a construct that could make its result differ from
+ * {@link VisitorModuleBlackBox} on the full syntax tree (parameters declared in a body, nested
+ * declarations, macros or directives within a header, unnamed instances...).
+ *
+ * @param sm Source manager owning \p buffer. It is used to parse the module headers.
+ * @param buffer Buffer to scan.
+ * @return The blackboxes by module name, or `nullptr` if a full parse is required.
+ */
+std::unique_ptr<std::unordered_map<std::string,std::unique_ptr<ModuleBlackBox>>>
+    prescan_module_blackboxes(slang::SourceManager& sm, const slang::SourceBuffer& buffer);
@@ -0,0 +1,173 @@
+#pragma once
+
+#include "slang/text/SourceManager.h"
+#include "slang/syntax/SyntaxTree.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace diplomat::cache
+{
+    /**
+     * @brief Shared store of source buffers and syntax trees.
+     * 
+     * Trees are kept from one compilation to the next, such that only the modified files 
+     * are parsed again. The same trees are used by the document cache to extract the
+     * blackboxes, so that each file is read and parsed once.
+     *
+     * All trees of a compilation shall share the same source manager, which is therefore kept
+     * along with the trees. As the source manager caches the file contents by path, a modified
+     * file is loaded under an alias of its path (`dir/./file.sv`, `dir/././file.sv`...) that
+     * resolves to the same file once canonicalized.
+     *
+     * The source manager, and all trees with it, is rebuilt when the include directories change,
+     * when an included file is modified, or when too many outdated buffers or aliases of a 
+     * single file have piled up.
+     *
+     * All the methods are thread-safe.
+     */
+    class SyntaxTreeCache
+    {
+        public:
+            using tree_ptr_t = std::shared_ptr<slang::syntax::SyntaxTree>;
+
+            /**
+             * @brief State of a file when its content was read.
+             * The size and modification time are taken before reading, the hash is 
+             * the one of the content actually parsed.
+             */
+            struct FileStamp
+            {
+                std::uintmax_t size;
+                std::filesystem::file_time_type mtime;
+                std::uint64_t hash;
+            };
+
+            /**
+             * @brief Set of trees, along with the source manager that owns them.
+             */
+            struct TreeSet
+            {
+                std::shared_ptr<slang::SourceManager> sm;
+                std::vector<tree_ptr_t> trees;
+                //! Stamps of the files, the hash being computed by DiplomatDocumentCache::hash_content.
+                //! Overlays have a `file_time_type::min()` modification time.
+                std::vector<FileStamp> stamps;
+            };
+
+            /**
+             * @brief Set the include directories to use for the next parsing.
+             * Any change will reset the whole cache when the trees are next requested.
+             *
+             * @param include_dirs Include directories, in lookup order.
+             */
+            void set_include_dirs(const std::vector<std::string>& include_dirs);
+
+            /**
+             * @brief Set the number of threads used to parse the files.
+             *
+             * @param threads Number of threads, 0 to use all available cores.
+             */
+            void set_parse_threads(unsigned int threads);
+
+            /**
+             * @brief Use an in-memory content for a file, instead of reading it from the disk.
+             * This is used for the documents edited in the client.
+             *
+             * @param fpath File to override, expected to be a standardized path.
+             * @param content Content to use.
+             */
+            void set_overlay(const std::filesystem::path& fpath, std::string content);
+
+            /**
+             * @brief Read a file from the disk again, after a call to #set_overlay.
+             */
+            void remove_overlay(const std::filesystem::path& fpath);
+
+            /**
+             * @brief Get the syntax trees of the given files, in the same order.
+             * Files that are new or modified since the last call are parsed.
+             *
+             * @param files Files to get, expected to be standardized paths.
+             * @param drop_others If set, the trees of the files that are not part of \p files are dropped.
+             * @return Syntax trees, with `nullptr` for the files that could not be read.
+             */
+            TreeSet get_trees(const std::vector<std::filesystem::path>& files, bool drop_others = false);
+
+            /**
+             * @brief Drop all trees and the source manager.
+             */
+            void clear();
+
+        protected:
+            struct TreeEntry
+            {
+                FileStamp stamp;
+                tree_ptr_t tree;
+                //! Set for trees that missed an include file, which may appear later on.
+                bool always_reparse;
+            };
+
+            std::mutex _access;
+
+            //! Declared first so that trees are released before it.
+            std::shared_ptr<slang::SourceManager> _sm;
+            //! Include directories used by #_sm, and requested ones.
+            std::vector<std::string> _include_dirs;
+            std::vector<std::string> _requested_include_dirs;
+
+            std::unordered_map<std::filesystem::path, TreeEntry> _trees;
+
+            //! Number of parsing threads, 0 for all available cores.
+            unsigned int _parse_threads = 0;
+
+            //! In-memory contents that replace the files on the disk.
+            std::unordered_map<std::filesystem::path, std::string> _overlays;
+
+            //! Number of time a file has been loaded in #_sm, to build aliases.
+            std::unordered_map<std::filesystem::path, unsigned int> _revisions;
+            //! Highest value of #_revisions, which bounds the alias length.
+            unsigned int _max_revision = 0;
+
+            //! Files included by the cached trees, with their stamp when loaded.
+            //! Only the size and modification time are used.
+            std::unordered_map<std::filesystem::path, FileStamp> _includes;
+
+            //! Buffers of #_sm that are not used by a cached tree anymore.
+            std::size_t _stale_buffers = 0;
+
+            //! Last buffer of #_sm checked for includes.
+            std::uint32_t _last_scanned_buffer = 0;
+
+            /**
+             * @brief Check that the cached trees are still usable with the requested include
+             * directories and the current included files, and reset the cache otherwise.
+             */
+            void _prepare();
+
+            void _clear();
+
+            /**
+             * @brief Load and parse a file, in a new buffer.
+             * May be run concurrently for different files.
+             *
+             * @param fpath File to load
+             * @param content Content of the file.
+             * @param revision Alias counter of the file, from #_revisions.
+             * @return Parsed tree.
+             */
+            tree_ptr_t _parse(const std::filesystem::path& fpath, std::string_view content, unsigned int& revision);
+
+            /**
+             * @brief Record the files included by the buffers loaded since the last call.
+             */
+            void _record_includes();
+
+            static bool _read_stamp(const std::filesystem::path& fpath, FileStamp& stamp);
+    };
+}
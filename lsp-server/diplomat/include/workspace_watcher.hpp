@@ -0,0 +1,104 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace diplomat::cache
+{
+    /**
+     * @brief Watch the workspace directories for file changes, such that the document cache
+     * may be updated incrementally instead of rescanning the whole workspace.
+     *
+     * Events are accumulated by a background thread and retrieved with {@link take_events}.
+     * This is currently only implemented through inotify (Linux). On other platforms,
+     * {@link start} always fails and the caller shall keep doing full workspace scans.
+     */
+    class WorkspaceWatcher
+    {
+        public:
+            enum class EventKind
+            {
+                Changed,    //!< File written, created or moved into the workspace.
+                Removed,    //!< File or directory deleted or moved out of the workspace.
+                Overflow    //!< Events were lost, a full rescan is needed.
+            };
+
+            struct Event
+            {
+                EventKind kind;
+                std::filesystem::path path;
+            };
+
+            //! Return true when the path (file or directory) shall not be watched.
+            using exclusion_filter_t = std::function<bool(const std::filesystem::path&)>;
+
+            WorkspaceWatcher() = default;
+            ~WorkspaceWatcher();
+
+            WorkspaceWatcher(const WorkspaceWatcher&) = delete;
+            WorkspaceWatcher& operator=(const WorkspaceWatcher&) = delete;
+
+            /**
+             * @brief Start watching the given roots, recursively.
+             * Any previously running watch is stopped first.
+             *
+             * Watches are all set up when this function returns, so that a full scan
+             * performed afterward will not miss any modification.
+             *
+             * @param roots Workspace root directories.
+             * @param is_excluded Filter for the directories and files to ignore.
+             * It is called from the watcher thread, thus shall not refer to any shared state.
+             * @return true if the watcher is running.
+             */
+            bool start(const std::unordered_set<std::filesystem::path>& roots, exclusion_filter_t is_excluded);
+
+            /**
+             * @brief Stop the watcher and drop the pending events.
+             */
+            void stop();
+
+            inline bool is_running() const { return _fd >= 0; };
+
+            /**
+             * @brief Retrieve and clear the events received since the last call.
+             */
+            std::vector<Event> take_events();
+
+        protected:
+            //! inotify file descriptor, negative when not running.
+            int _fd = -1;
+
+            exclusion_filter_t _is_excluded;
+
+            //! Watch descriptor to watched directory. Only accessed by the watcher thread once started.
+            std::unordered_map<int, std::filesystem::path> _watched_dirs;
+
+            std::mutex _events_access;
+            std::vector<Event> _events;
+
+            std::jthread _watch_thread;
+
+            /**
+             * @brief Add a watch on a directory and all of its sub-directories.
+             *
+             * @param dir Directory to watch
+             * @param report_files If set, a Changed event is emitted for each file found,
+             * to catch the files created before the watch was set.
+             * @return false if a watch could not be added.
+             */
+            bool _watch_tree(const std::filesystem::path& dir, bool report_files);
+
+            //! Remove the watches of a directory and all of its sub-directories.
+            void _unwatch_tree(const std::filesystem::path& dir);
+
+            void _push_event(EventKind kind, const std::filesystem::path& path);
+
+            void _watch_loop(std::stop_token stok);
+    };
+}
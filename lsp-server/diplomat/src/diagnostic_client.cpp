@@ -29,6 +29,7 @@ namespace slsp
     {
         for (auto& [key, value] : _diagnostics)
             value->diagnostics.clear();
+        _hashes.clear();
     }
 
     /**
@@ -38,10 +39,13 @@ namespace slsp
      */
     void LSPDiagnosticClient::_cleanup_diagnostics()
     {
-        std::erase_if(_diagnostics, [](const auto &item)
+        std::erase_if(_diagnostics, [this](const auto &item)
         {
             auto const& [key, value] = item;
-            return value->diagnostics.size() == 0; 
+            if(value->diagnostics.size() != 0)
+                return false;
+            _hashes.erase(key);
+            return true;
         });
     }
 
@@ -127,6 +131,7 @@ namespace slsp
         }
 
         pub->diagnostics.push_back(diag);
+        _hashes.erase(the_uri);
         _last_publication = pub;
     }
 
@@ -163,6 +168,7 @@ namespace slsp
 
             // It is assumed that the original report already exists and was the last one emitted.
             Diagnostic &orig_diag = _last_publication->diagnostics.back();
+            _hashes.erase(_last_publication->uri);
 
             if (!orig_diag.relatedInformation)
             {
@@ -200,10 +206,12 @@ namespace slsp
             record.key() = new_uri;
             _diagnostics.insert(std::move(record));           
 
+            // Related information of any URI may point to the remapped one.
             for(auto& diag : _diagnostics)
             {
                 _remap_internal_diagnostic_uri(diag.second.get(),orig_uri,new_uri);
             }
+            _hashes.clear();
 
             // Used to trigger diagnostic deletion on client side
             std::unique_ptr<PublishDiagnosticsParams> placeholder = std::make_unique<PublishDiagnosticsParams>();
@@ -216,6 +224,98 @@ namespace slsp
     }
 
 
+    void LSPDiagnosticClient::replace_syntax_diagnostics(const std::string& uri, std::vector<Diagnostic> syntax_diags)
+    {
+        std::unique_ptr<PublishDiagnosticsParams>& pub = _diagnostics[uri];
+        if(! pub)
+        {
+            pub = std::make_unique<PublishDiagnosticsParams>();
+            pub->uri = uri;
+        }
+
+        std::erase_if(pub->diagnostics, is_syntax_diagnostic);
+        pub->diagnostics.insert(pub->diagnostics.end(), 
+            std::make_move_iterator(syntax_diags.begin()), std::make_move_iterator(syntax_diags.end()));
+        _hashes.erase(uri);
+
+        // Related diagnostics shall not be attached to a moved publication.
+        _last_publication = nullptr;
+    }
+
+    bool LSPDiagnosticClient::is_syntax_diagnostic(const Diagnostic& diag)
+    {
+        if(! diag.code)
+            return false;
+
+        // Codes are built as "<subsystem>.<code> <name>" by report_new_diagnostic
+        const std::string code = nlohmann::json(diag.code.value()).template get<std::string>();
+        const std::size_t sep = code.find('.');
+        if(sep == std::string::npos)
+            return false;
+
+        const std::string subsystem = code.substr(0, sep);
+        return subsystem == std::to_string((uint16_t)slang::DiagSubsystem::Lexer)
+            || subsystem == std::to_string((uint16_t)slang::DiagSubsystem::Preprocessor)
+            || subsystem == std::to_string((uint16_t)slang::DiagSubsystem::Parser);
+    }
+
+    std::unordered_map<std::string, std::size_t> LSPDiagnosticClient::count_diagnostics() const
+    {
+        std::unordered_map<std::string, std::size_t> ret;
+        for(const auto& [key, value] : _diagnostics)
+            ret[key] = value->diagnostics.size();
+        return ret;
+    }
+
+    nlohmann::json LSPDiagnosticClient::export_diagnostics(const std::unordered_map<std::string, std::size_t>& skip) const
+    {
+        nlohmann::json ret = nlohmann::json::object();
+        for(const auto& [key, value] : _diagnostics)
+        {
+            auto skipped = skip.find(key);
+            std::size_t first = skipped == skip.end() ? 0 : skipped->second;
+            if(first >= value->diagnostics.size())
+                continue;
+
+            nlohmann::json& diags = ret[key] = nlohmann::json::array();
+            for(std::size_t i = first; i < value->diagnostics.size(); i++)
+                diags.push_back(value->diagnostics[i]);
+        }
+        return ret;
+    }
+
+    void LSPDiagnosticClient::append_diagnostics(const nlohmann::json& diagnostics)
+    {
+        for(const auto& [key, value] : diagnostics.items())
+        {
+            std::unique_ptr<PublishDiagnosticsParams>& pub = _diagnostics[key];
+            if(! pub)
+            {
+                pub = std::make_unique<PublishDiagnosticsParams>();
+                pub->uri = key;
+            }
+
+            for(const nlohmann::json& diag : value)
+                pub->diagnostics.push_back(diag.template get<Diagnostic>());
+            _hashes.erase(key);
+        }
+
+        // Related diagnostics shall only follow a reported one.
+        _last_publication = nullptr;
+    }
+
+    std::uint64_t LSPDiagnosticClient::diagnostics_hash(const std::string& uri)
+    {
+        auto known = _hashes.find(uri);
+        if(known != _hashes.end())
+            return known->second;
+
+        const nlohmann::json diags = _diagnostics.at(uri)->diagnostics;
+        const std::uint64_t hash = diplomat::cache::DiplomatDocumentCache::hash_content(diags.dump());
+        _hashes[uri] = hash;
+        return hash;
+    }
+
     /**
      * @brief Update the URI values matching a given URI within a diagnostic set.
      * 
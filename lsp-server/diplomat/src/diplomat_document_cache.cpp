@@ -1,8 +1,14 @@
 #include "fmt/format.h"
 #include "slang/text/SourceManager.h"
+#include "slang/syntax/SyntaxTree.h"
+#include "slang/util/ThreadPool.h"
 #include <spdlog/spdlog.h>
 #include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unordered_set>
 #include "diplomat_document_cache.hpp"
+#include "module_bb_prescan.hpp"
 
 namespace fs = std::filesystem;
 namespace diplomat::cache
@@ -74,14 +80,11 @@ void DiplomatDocumentCache::clear_project()
 
 void DiplomatDocumentCache::refresh(bool prj_only)
 {
-	for(const auto& fpath : _prj_files )
-		process_file(fpath,true);
+	// Copies, as processing may update the file lists.
+	process_files(std::vector<fs::path>(_prj_files.cbegin(),_prj_files.cend()),true);
 
 	if(! prj_only)
-	{
-		for (const auto& fpath : _ws_files)
-			process_file(fpath,false);
-	}
+		process_files(std::vector<fs::path>(_ws_files.cbegin(),_ws_files.cend()),false);
 }
 
 /**
@@ -170,16 +173,15 @@ uri DiplomatDocumentCache::get_uri(const std::filesystem::path& fpath) const
 }
 
 
-void DiplomatDocumentCache::process_file(const std::filesystem::path& fpath, bool in_prj)
+std::optional<fs::path> DiplomatDocumentCache::_prepare_processing(const std::filesystem::path& fpath, bool& in_prj)
 {
-	bool auto_dispose = ! _sm.get();
 	spdlog::debug("Request for cache processing {}",fpath.generic_string());
 	fs::path curr_path = standardize_path(fpath);
 
 	if(! fs::exists(curr_path))
 	{
 		spdlog::error("File not found: {}", fpath.generic_string());
-		return;
+		return {};
 	}
 
 	// If the passed file has been already processed, check if the 
@@ -190,7 +192,7 @@ void DiplomatDocumentCache::process_file(const std::filesystem::path& fpath, boo
 		{
 			// Update the "in_prj" status and exit
 			record_file(curr_path,in_prj);
-			return;
+			return {};
 		}
 		else
 		{
@@ -201,17 +203,15 @@ void DiplomatDocumentCache::process_file(const std::filesystem::path& fpath, boo
 		}
 	}
 
-	// If the file has never been processed (or need recomputing)
-	// We will need to parse it and map the appropriates infos at the right places.
-
-	if(auto_dispose)
-		_sm.reset(new slang::SourceManager());
+	return curr_path;
+}
 
-	auto st = slang::syntax::SyntaxTree::fromFile(curr_path.generic_string(),*_sm).value();
-	VisitorModuleBlackBox visitor;
-	st->root().visit(visitor);
+void DiplomatDocumentCache::_store_blackboxes(const std::filesystem::path& curr_path, bb_map_t& read_bb, bool in_prj, const std::optional<DiskStamp>& stamp)
+{
+	if(stamp)
+		_record_disk_entry(curr_path, read_bb, stamp.value());
 
-	if(visitor.read_bb->empty())
+	if(read_bb.empty())
 	{
 		// If no blackbox are present, there is a need to record the file in the path to bb association to
 		// avoid issues downstream and maintain coherent behavior across all files.
@@ -219,10 +219,10 @@ void DiplomatDocumentCache::process_file(const std::filesystem::path& fpath, boo
 	}
 	else 
 	{
-		for(const auto modname : std::views::keys(*(visitor.read_bb.get())))
+		for(const auto modname : std::views::keys(read_bb))
 		{
 					
-			const auto insert_ok = _bb_storage.emplace((std::intptr_t)(visitor.read_bb->at(modname).get()),std::move(visitor.read_bb->at(modname)));
+			const auto insert_ok = _bb_storage.emplace((std::intptr_t)(read_bb.at(modname).get()),std::move(read_bb.at(modname)));
 			const ModuleBlackBox* bb_ptr = insert_ok.first->second.get();
 			
 			if(_prj_files.contains(curr_path))
@@ -246,12 +246,241 @@ void DiplomatDocumentCache::process_file(const std::filesystem::path& fpath, boo
    
 	_processed_timestamp[curr_path] = std::chrono::file_clock::now();
 	record_file(curr_path,in_prj);
+}
+
+void DiplomatDocumentCache::process_file(const std::filesystem::path& fpath, bool in_prj)
+{
+	bool auto_dispose = ! _sm.get();
+	std::optional<fs::path> curr_path = _prepare_processing(fpath, in_prj);
+	if(! curr_path)
+		return;
+
+	if(std::unique_ptr<bb_map_t> cached = _lookup_disk_cache(curr_path.value()))
+	{
+		_store_blackboxes(curr_path.value(), *cached, in_prj, {});
+		return;
+	}
+
+	// If the file has never been processed (or need recomputing)
+	// We will need to parse it and map the appropriates infos at the right places.
+
+	if(_use_tree_store(in_prj))
+	{
+		std::vector<std::unique_ptr<bb_map_t>> read_bb;
+		std::vector<std::optional<DiskStamp>> stamps;
+		_extract_from_store(*_tree_store, {curr_path.value()}, read_bb, stamps);
+		if(read_bb.front())
+			_store_blackboxes(curr_path.value(), *read_bb.front(), in_prj, stamps.front());
+		else
+			spdlog::error("Unable to read file {}",curr_path->generic_string());
+		return;
+	}
+
+	if(auto_dispose)
+		_sm.reset(new slang::SourceManager());
+
+	DiskStamp stamp;
+	std::unique_ptr<bb_map_t> read_bb = _extract_blackboxes(curr_path.value(), *_sm, stamp);
+	if(read_bb)
+		_store_blackboxes(curr_path.value(), *read_bb, in_prj, stamp);
+	else
+		spdlog::error("Unable to read file {}",curr_path->generic_string());
 
 	if(auto_dispose)
 		_sm.reset();
 
 }
 
+/**
+ * Files that will be compiled are taken from the shared tree store, if any.
+ * The other ones are parsed with their own source manager, which is released as soon
+ * as the blackboxes are extracted, to keep the memory usage bounded.
+ * 
+ * @note Files that fail to load are skipped (and logged) instead of aborting 
+ * the whole batch.
+ */
+void DiplomatDocumentCache::process_files(const std::vector<std::filesystem::path>& fpaths, bool in_prj, unsigned int threads)
+{
+	FileBatch batch = prepare_files(fpaths, in_prj);
+	extract_files(batch, threads);
+	merge_files(batch);
+}
+
+DiplomatDocumentCache::FileBatch DiplomatDocumentCache::prepare_files(const std::vector<std::filesystem::path>& fpaths, bool in_prj)
+{
+	FileBatch batch;
+	batch.tree_store = _tree_store;
+	std::unordered_set<fs::path> queued;
+
+	for(const fs::path& fpath : fpaths)
+	{
+		bool file_in_prj = in_prj;
+		if(std::optional<fs::path> curr_path = _prepare_processing(fpath, file_in_prj))
+		{
+			if(queued.contains(curr_path.value()))
+				batch.deferred_records.emplace_back(curr_path.value(), file_in_prj);
+			else if(std::unique_ptr<bb_map_t> cached = _lookup_disk_cache(curr_path.value()))
+			{
+				// Still up to date in the persistent cache, no need to parse.
+				queued.insert(curr_path.value());
+				_store_blackboxes(curr_path.value(), *cached, file_in_prj, {});
+			}
+			else
+			{
+				queued.insert(curr_path.value());
+				batch.tasks.push_back(FileBatch::Task{curr_path.value(), file_in_prj, _use_tree_store(file_in_prj), nullptr, {}});
+			}
+		}
+	}
+	return batch;
+}
+
+void DiplomatDocumentCache::extract_files(FileBatch& batch, unsigned int threads)
+{
+	if(batch.tasks.empty())
+		return;
+
+	spdlog::info("Parse {} files to extract blackboxes", batch.tasks.size());
+
+	// Files that will be compiled are parsed once, in the shared store.
+	std::vector<fs::path> stored_paths;
+	std::vector<FileBatch::Task*> stored_tasks;
+	for(FileBatch::Task& task : batch.tasks)
+	{
+		if(task.from_store)
+		{
+			stored_paths.push_back(task.path);
+			stored_tasks.push_back(&task);
+		}
+	}
+
+	if(! stored_paths.empty())
+	{
+		std::vector<std::unique_ptr<bb_map_t>> read_bb;
+		std::vector<std::optional<DiskStamp>> stamps;
+		_extract_from_store(*batch.tree_store, stored_paths, read_bb, stamps);
+		for(std::size_t i = 0; i < stored_tasks.size(); i++)
+		{
+			stored_tasks[i]->read_bb = std::move(read_bb[i]);
+			stored_tasks[i]->stamp = stamps[i];
+		}
+	}
+
+	// Parsing of the other ones, in parallel. Each task only touches its own slot.
+	if(stored_tasks.size() < batch.tasks.size())
+	{
+		slang::ThreadPool pool(threads);
+		for(FileBatch::Task& task : batch.tasks)
+		{
+			if(task.from_store)
+				continue;
+
+			pool.pushTask([&task]() {
+				try
+				{
+					slang::SourceManager sm;
+					DiskStamp stamp;
+					task.read_bb = _extract_blackboxes(task.path, sm, stamp);
+					if(task.read_bb)
+						task.stamp = stamp;
+				}
+				catch(const std::exception& e)
+				{
+					spdlog::error("Failed to extract blackboxes from {}: {}",task.path.generic_string(),e.what());
+				}
+			});
+		}
+		pool.waitForAll();
+	}
+}
+
+/**
+ * The selected files are not recorded until merged, so that a file found recorded
+ * here has been processed again by another call in the meantime, with a newer content.
+ */
+void DiplomatDocumentCache::merge_files(FileBatch& batch)
+{
+	for(FileBatch::Task& task : batch.tasks)
+	{
+		if(_processed_timestamp.contains(task.path))
+		{
+			spdlog::debug("{} processed meanwhile, keep the newer blackboxes.", task.path.generic_string());
+			continue;
+		}
+
+		if(! task.read_bb)
+		{
+			spdlog::error("Unable to read file {}",task.path.generic_string());
+			continue;
+		}
+		_store_blackboxes(task.path, *task.read_bb, task.in_prj, task.stamp);
+	}
+
+	for(const auto& [path, file_in_prj] : batch.deferred_records)
+	{
+		if(_processed_timestamp.contains(path))
+			record_file(path, file_in_prj);
+	}
+}
+
+void DiplomatDocumentCache::_extract_from_store(SyntaxTreeCache& store, const std::vector<std::filesystem::path>& fpaths, 
+	std::vector<std::unique_ptr<bb_map_t>>& read_bb, std::vector<std::optional<DiskStamp>>& stamps)
+{
+	SyntaxTreeCache::TreeSet set = store.get_trees(fpaths);
+	read_bb.clear();
+	stamps.clear();
+	for(std::size_t i = 0; i < set.trees.size(); i++)
+	{
+		const SyntaxTreeCache::tree_ptr_t& tree = set.trees[i];
+		const SyntaxTreeCache::FileStamp& fstamp = set.stamps[i];
+		if(! tree)
+		{
+			read_bb.push_back(nullptr);
+			stamps.push_back(std::nullopt);
+			continue;
+		}
+
+		VisitorModuleBlackBox visitor;
+		tree->root().visit(visitor);
+		read_bb.push_back(std::move(visitor.read_bb));
+
+		// In-memory contents do not match what is on the disk.
+		if(fstamp.mtime == fs::file_time_type::min())
+			stamps.push_back(std::nullopt);
+		else
+			stamps.push_back(DiskStamp{fstamp.size, fstamp.mtime.time_since_epoch().count(), fstamp.hash});
+	}
+}
+
+/**
+ * The stamp is read before the file, such that a modification made while reading is 
+ * detected when recording the persistent cache entry.
+ */
+std::unique_ptr<DiplomatDocumentCache::bb_map_t> DiplomatDocumentCache::_extract_blackboxes(const std::filesystem::path& fpath, slang::SourceManager& sm, DiskStamp& stamp)
+{
+	if(! _read_disk_stamp(fpath, stamp))
+		return nullptr;
+
+	auto buffer = sm.readSource(fpath, nullptr);
+	if(! buffer)
+		return nullptr;
+
+	// The source manager null-terminates the buffers.
+	std::string_view content = buffer->data;
+	if(! content.empty() && content.back() == '\0')
+		content.remove_suffix(1);
+	stamp.hash = hash_content(content);
+
+	if(std::unique_ptr<bb_map_t> prescanned = prescan_module_blackboxes(sm, buffer.value()))
+		return prescanned;
+
+	spdlog::trace("Prescan of {} is not conclusive, use a full parse.",fpath.generic_string());
+	auto st = slang::syntax::SyntaxTree::fromBuffer(buffer.value(), sm);
+	VisitorModuleBlackBox visitor;
+	st->root().visit(visitor);
+	return std::move(visitor.read_bb);
+}
+
 void DiplomatDocumentCache::process_file(const uri& uri, const bool in_prj)
 {
 	process_file(fs::path("/" + uri.get_path()), in_prj);
@@ -306,9 +535,204 @@ void DiplomatDocumentCache::remove_file(const std::filesystem::path& fpath)
 		// file references.
 		_path_to_bb.erase(path);
 		_doc_path_to_client_uri.erase(path);
+		if(_disk_entries.erase(path))
+			_disk_cache_dirty = true;
 		_prj_files.erase(path);
 		_ws_files.erase(path);
 		_processed_timestamp.erase(path);
 	}
 }
+
+std::uint64_t DiplomatDocumentCache::hash_content(std::string_view content)
+{
+	std::uint64_t h = 0xcbf29ce484222325ULL;
+	for(const char c : content)
+	{
+		h ^= static_cast<unsigned char>(c);
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+bool DiplomatDocumentCache::_read_disk_stamp(const std::filesystem::path& fpath, DiskStamp& stamp)
+{
+	std::error_code ec;
+	stamp.size = fs::file_size(fpath,ec);
+	if(ec)
+		return false;
+	stamp.mtime = fs::last_write_time(fpath,ec).time_since_epoch().count();
+	return ! ec;
+}
+
+std::optional<std::uint64_t> DiplomatDocumentCache::hash_file(const std::filesystem::path& fpath)
+{
+	std::ifstream in(fpath, std::ios::binary);
+	if(! in)
+		return {};
+
+	std::ostringstream content;
+	content << in.rdbuf();
+	return hash_content(content.view());
+}
+
+/**
+ * The modification time is checked first as it is cheap. If it differs but the size is 
+ * the same, the content hash is checked as the file may only have been touched.
+ */
+std::unique_ptr<DiplomatDocumentCache::bb_map_t> DiplomatDocumentCache::_lookup_disk_cache(const std::filesystem::path& fpath)
+{
+	auto found = _disk_entries.find(fpath);
+	if(found == _disk_entries.end())
+		return nullptr;
+
+	DiskCacheEntry& entry = found->second;
+	DiskStamp current;
+	if(! _read_disk_stamp(fpath, current) || current.size != entry.size)
+		return nullptr;
+
+	if(current.mtime != entry.mtime)
+	{
+		std::optional<std::uint64_t> hash = hash_file(fpath);
+		if(! hash || hash.value() != entry.hash)
+			return nullptr;
+
+		entry.mtime = current.mtime;
+		_disk_cache_dirty = true;
+	}
+
+	std::unique_ptr<bb_map_t> ret = std::make_unique<bb_map_t>();
+	try
+	{
+		for(const nlohmann::json& j : entry.blackboxes)
+		{
+			std::unique_ptr<ModuleBlackBox> bb = std::make_unique<ModuleBlackBox>(j.template get<ModuleBlackBox>());
+			std::string name = bb->module_name;
+			ret->emplace(name,std::move(bb));
+		}
+	}
+	catch(const nlohmann::json::exception& e)
+	{
+		spdlog::warn("Invalid persistent cache record for {}: {}", fpath.generic_string(), e.what());
+		_disk_entries.erase(found);
+		_disk_cache_dirty = true;
+		return nullptr;
+	}
+
+	spdlog::trace("Use persistent cache for {}", fpath.generic_string());
+	return ret;
+}
+
+void DiplomatDocumentCache::_record_disk_entry(const std::filesystem::path& fpath, const bb_map_t& read_bb, const DiskStamp& stamp)
+{
+	// The file changed while being processed: the blackboxes may not match
+	// its current content, so that it shall be parsed again next time.
+	DiskStamp current;
+	if(! _read_disk_stamp(fpath, current) || current.size != stamp.size || current.mtime != stamp.mtime)
+	{
+		spdlog::debug("{} changed while being processed, not cached.", fpath.generic_string());
+		if(_disk_entries.erase(fpath))
+			_disk_cache_dirty = true;
+		return;
+	}
+
+	DiskCacheEntry entry;
+	entry.size = stamp.size;
+	entry.mtime = stamp.mtime;
+	entry.hash = stamp.hash;
+	entry.blackboxes = nlohmann::json::array();
+	for(const auto& [name, bb] : read_bb)
+		entry.blackboxes.push_back(*bb);
+
+	_disk_entries.insert_or_assign(fpath,std::move(entry));
+	_disk_cache_dirty = true;
+}
+
+bool DiplomatDocumentCache::load_disk_cache(const std::filesystem::path& cache_file, const std::string& version)
+{
+	std::ifstream in(cache_file);
+	if(! in)
+	{
+		spdlog::info("No persistent cache found at {}", cache_file.generic_string());
+		return false;
+	}
+
+	try
+	{
+		nlohmann::json j = nlohmann::json::parse(in);
+		if(j.at("version").template get<std::string>() != version)
+		{
+			spdlog::info("Persistent cache {} discarded due to version mismatch.", cache_file.generic_string());
+			return false;
+		}
+
+		for(const auto& [path, record] : j.at("files").items())
+		{
+			DiskCacheEntry entry;
+			record.at("size").get_to(entry.size);
+			record.at("mtime").get_to(entry.mtime);
+			record.at("hash").get_to(entry.hash);
+			entry.blackboxes = record.at("blackboxes");
+			_disk_entries.insert_or_assign(fs::path(path),std::move(entry));
+		}
+	}
+	catch(const nlohmann::json::exception& e)
+	{
+		spdlog::warn("Unable to read the persistent cache {}: {}", cache_file.generic_string(), e.what());
+		_disk_entries.clear();
+		return false;
+	}
+
+	spdlog::info("Loaded {} records from persistent cache {}", _disk_entries.size(), cache_file.generic_string());
+	_disk_cache_dirty = false;
+	return true;
+}
+
+/**
+ * The cache is written to a temporary file which is then renamed, to never leave 
+ * a partially written cache behind.
+ */
+bool DiplomatDocumentCache::save_disk_cache(const std::filesystem::path& cache_file, const std::string& version)
+{
+	if(! _disk_cache_dirty)
+		return true;
+
+	nlohmann::json files = nlohmann::json::object();
+	for(const auto& [path, entry] : _disk_entries)
+	{
+		files[path.generic_string()] = {
+			{"size",entry.size},
+			{"mtime",entry.mtime},
+			{"hash",entry.hash},
+			{"blackboxes",entry.blackboxes}
+		};
+	}
+
+	std::error_code ec;
+	fs::create_directories(cache_file.parent_path(),ec);
+	fs::path tmp_file = cache_file;
+	tmp_file += ".tmp";
+	{
+		std::ofstream out(tmp_file);
+		if(! out)
+		{
+			spdlog::warn("Unable to write the persistent cache {}", tmp_file.generic_string());
+			return false;
+		}
+		out << nlohmann::json{{"version",version},{"files",std::move(files)}}.dump();
+		if(! out)
+			return false;
+	}
+
+	fs::rename(tmp_file,cache_file,ec);
+	if(ec)
+	{
+		spdlog::warn("Unable to write the persistent cache {}: {}", cache_file.generic_string(), ec.message());
+		return false;
+	}
+
+	spdlog::info("Saved {} records to persistent cache {}", _disk_entries.size(), cache_file.generic_string());
+	_disk_cache_dirty = false;
+	return true;
+}
+
 } // namespace diplomat::cache
\ No newline at end of file
@@ -6,11 +6,13 @@
 #include "spdlog/spdlog.h"
 
 #include <chrono>
+#include <functional>
 #include <stdexcept>
 #include "types/structs/SetTraceParams.hpp"
 
 #include "slang/diagnostics/AllDiags.h"
 #include "slang/util/Bag.h"
+#include "slang/util/VersionInfo.h"
 
 #include "types/structs/InitializeParams.hpp"
 #include "types/structs/InitializeResult.hpp"
@@ -24,32 +26,90 @@
 
 #include "index_visitor.hpp"
 #include "index_reference_visitor.hpp"
+#include "index_serializer.hpp"
+#include "hier_visitor.h"
 
 // UNIX only header
 #include <sys/wait.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <cstring>
 #include <fstream>
+#include <sstream>
+#include <set>
 
 #include "uri.hh"
 
+#ifndef DIPLOMAT_VERSION_STRING
+#define DIPLOMAT_VERSION_STRING "custom-build"
+#endif
+
 using namespace slsp::types;
 
 namespace fs = std::filesystem;
 
+/**
+ * @brief Format version of the persistent blackbox cache.
+ * To be incremented on any change in the cache content.
+ */
+static constexpr int DISK_CACHE_FORMAT = 1;
+
+//! Exit codes of the compilation child process.
+static constexpr int COMPILE_WORKER_FAILED = 1;
+static constexpr int COMPILE_WORKER_OUT_OF_MEMORY = 2;
+
+//! File descriptor on which the compilation child process writes its results.
+static constexpr int COMPILE_WORKER_RESULT_FD = 3;
+
+//! Period to check for superseding and for the memory limit while waiting for the compilation child process.
+static constexpr int COMPILE_WORKER_POLL_PERIOD_MS = 50;
+static constexpr std::size_t COMPILE_WORKER_READ_SIZE = 1 << 16;
+
+/**
+ * @brief Get the resident memory of a process, from `/proc/<pid>/statm`.
+ * 
+ * @return Resident size in bytes, or nothing if it could not be read.
+ */
+static std::optional<std::uint64_t> process_resident_size(pid_t pid)
+{
+    std::ifstream statm(fmt::format("/proc/{}/statm", pid));
+    std::uint64_t total_pages, resident_pages;
+    if(! (statm >> total_pages >> resident_pages))
+        return {};
+    return resident_pages * static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE));
+}
+
+/**
+ * @brief Options of the design compilation, shared by the server and the compilation process.
+ */
+static slang::ast::CompilationOptions compilation_options(const std::optional<std::string>& top_level)
+{
+    slang::ast::CompilationOptions coptions;
+    coptions.flags = slang::ast::CompilationFlags::AllowHierarchicalConst 
+    | slang::ast::CompilationFlags::AllowTopLevelIfacePorts ;
+    if(top_level)
+        coptions.topModules = {top_level.value()};
+    return coptions;
+}
+
 
 /**
  * @brief Checks that the index is in a working state and may be used.
  * 
+ * @param index Index snapshot to check, as returned by #_get_index
  * @param always_throw if set, throw on each call instead of the first failing one
  * @return true if the index is in a working state
  * @return false otherwise.
  */
-bool DiplomatLSP::_assert_index(bool always_throw)
+bool DiplomatLSP::_assert_index(const diplomat::index::IndexCore* index, bool always_throw)
 {
-    if (_index == nullptr)
+    if (index == nullptr)
     {
-        if (!_broken_index_emitted || always_throw)
+        if (!_broken_index_emitted.exchange(true) || always_throw)
         {
-            _broken_index_emitted = true;
             throw slsp::lsp_request_failed_exception(
                 "Request failed due to broken index."
                 "Try fixing any diagnostic before re - running.");
@@ -68,19 +128,38 @@ bool DiplomatLSP::_assert_index(bool always_throw)
  * @param os Output stream used for low level communication with the client.
  * @param watch_client_pid If set, should exit/kill the server when the watced PID stop running.
  */
-DiplomatLSP::DiplomatLSP(std::istream &is, std::ostream &os, bool watch_client_pid) : BaseLSP(is, os), 
+DiplomatLSP::DiplomatLSP(std::istream &is, std::ostream &os, bool watch_client_pid) : 
+DiplomatLSP(is, os, watch_client_pid, -1)
+{
+}
+
+/**
+ * In a compilation child process, \p compile_worker_fd is the pipe to the server process
+ * and the compilation thread is not started.
+ */
+DiplomatLSP::DiplomatLSP(std::istream &is, std::ostream &os, bool watch_client_pid, int compile_worker_fd) : BaseLSP(is, os), 
 _sm(new slang::SourceManager()),
+_reset_tree_cache(false),
 _diagnostic_client(new slsp::LSPDiagnosticClient(_cache,_sm.get())),
+_skipped_diag_publications(0),
+_pull_diagnostics(false),
+_diag_refresh_support(false),
 _watch_client_pid(watch_client_pid),
 _project_file_tree_valid(false),
-_broken_index_emitted(true)
+_disk_cache_loaded(false),
+_ws_scan_valid(false),
+_broken_index_emitted(true),
+_compile_requested(false),
+_compile_generation(0),
+_compile_worker_fd(compile_worker_fd)
 {
     _unpack_args_for_customs = true;
+    _cache.set_tree_store(&_tree_cache, true);
     
     TextDocumentSyncOptions sync;
     sync.openClose = true;
     sync.save = true;
-    sync.change = TextDocumentSyncKind::TextDocumentSyncKind_None;
+    sync.change = TextDocumentSyncKind::TextDocumentSyncKind_Incremental;
 
     WorkspaceFoldersServerCapabilities ws;
     ws.supported = true;
@@ -101,6 +180,55 @@ _broken_index_emitted(true)
     capabilities.completionProvider = sc_completion;
 
     _bind_methods();    
+
+    if(_compile_worker_fd < 0)
+        _compile_worker = std::jthread(std::bind_front(&DiplomatLSP::_compile_loop, this));
+}
+
+std::shared_ptr<diplomat::index::IndexCore> DiplomatLSP::_get_index()
+{
+    std::lock_guard<std::mutex> lock(_index_access);
+    return _index;
+}
+
+void DiplomatLSP::_set_index(std::shared_ptr<diplomat::index::IndexCore> new_index)
+{
+    std::lock_guard<std::mutex> lock(_index_access);
+    _index.swap(new_index);
+    // Previous snapshot is freed here, unless still used by a request.
+}
+
+/**
+ * @brief Run the request, holding #_state_access as required.
+ * Concurrent requests only get a shared access.
+ */
+json DiplomatLSP::_invoke_request(const std::string& fct_name, json& args)
+{
+    // The actual command will be invoked through this same function, 
+    // and will take the lock then.
+    if(fct_name == "workspace/executeCommand")
+        return BaseLSP::_invoke_request(fct_name, args);
+
+    if(_concurrent_methods.contains(fct_name))
+    {
+        std::shared_lock lock(_state_access);
+        return BaseLSP::_invoke_request(fct_name, args);
+    }
+    
+    std::unique_lock lock(_state_access);
+    return BaseLSP::_invoke_request(fct_name, args);
+}
+
+void DiplomatLSP::_invoke_notif(const std::string& fct_name, json& args)
+{
+    std::unique_lock lock(_state_access);
+    BaseLSP::_invoke_notif(fct_name, args);
+}
+
+void DiplomatLSP::_run_callback(const std::string& id, json& args)
+{
+    std::unique_lock lock(_state_access);
+    BaseLSP::_run_callback(id, args);
 }
 
 /**
@@ -122,21 +250,6 @@ slsp::types::Location DiplomatLSP::_slang_to_lsp_location(const slang::SourceRan
     return result;
 }
 
-
-/**
- * @brief Always return a slang compilation of the workspace.
- * If no compilation has been done, run the compilation beforehand.
- * 
- * @return slang::ast::Compilation* compilation object for the workspace. 
- */
-slang::ast::Compilation* DiplomatLSP::get_compilation()
-{
-    if (_compilation == nullptr)
-        _compile();
-
-    return _compilation.get();
-}
-
 /**
  * @brief Binds all LSP methods to an internal handle (_h_* function)
  * This also registers the commands within the capabilities of the LSP
@@ -176,14 +289,29 @@ void DiplomatLSP::_bind_methods()
 
     bind_notification("textDocument/didClose", LSP_MEMBER_BIND(DiplomatLSP, _h_didCloseTextDocument));
     bind_notification("textDocument/didOpen", LSP_MEMBER_BIND(DiplomatLSP, _h_didOpenTextDocument));
+    bind_notification("textDocument/didChange", LSP_MEMBER_BIND(DiplomatLSP, _h_didChangeTextDocument));
     bind_notification("textDocument/didSave", LSP_MEMBER_BIND(DiplomatLSP, _h_didSaveTextDocument));
     bind_request("textDocument/completion", LSP_MEMBER_BIND(DiplomatLSP, _h_completion));
     bind_request("textDocument/definition", LSP_MEMBER_BIND(DiplomatLSP, _h_gotoDefinition));
     bind_request("textDocument/formatting", LSP_MEMBER_BIND(DiplomatLSP, _h_formatting));
     bind_request("textDocument/references", LSP_MEMBER_BIND(DiplomatLSP, _h_references));
+    bind_request("textDocument/diagnostic", LSP_MEMBER_BIND(DiplomatLSP, _h_document_diagnostic));
+    bind_request("workspace/diagnostic", LSP_MEMBER_BIND(DiplomatLSP, _h_workspace_diagnostic));
     bind_request("textDocument/rename", LSP_MEMBER_BIND(DiplomatLSP, _h_rename));
     bind_notification("workspace/didChangeWorkspaceFolders", LSP_MEMBER_BIND(DiplomatLSP, _h_didChangeWorkspaceFolders));
     bind_request("workspace/executeCommand", LSP_MEMBER_BIND(DiplomatLSP,_execute_command_handler));
+
+    // Read-only requests, that may run along a compilation.
+    set_concurrent("textDocument/completion");
+    set_concurrent("textDocument/definition");
+    set_concurrent("textDocument/formatting");
+    set_concurrent("textDocument/references");
+    set_concurrent("textDocument/rename");
+    set_concurrent("textDocument/diagnostic");
+    set_concurrent("workspace/diagnostic");
+    set_concurrent("diplomat-server.resolve-paths");
+    set_concurrent("diplomat-server.list-symbols");
+    set_concurrent("diplomat-server.get-hierarchy");
 }
 
 
@@ -191,13 +319,38 @@ void DiplomatLSP::_bind_methods()
  * @brief Send diagnostics for display to the client
  * 
  * In vscode, this is shown as "Problems" of the workspace. 
+ * 
+ * Only the URIs whose diagnostics differ from the last publication are sent, 
+ * based on the hashes kept by the diagnostic client. Cleared URIs are sent once, 
+ * then forgotten.
+ * 
+ * When the client pulls the diagnostics, nothing is sent: the hashes are used
+ * as result IDs, and the client is requested to pull again if anything changed.
  */
 void DiplomatLSP::_emit_diagnostics()
 {
     if (_diagnostic_client.get() != nullptr)
     {
+        std::size_t skipped = 0;
+        std::size_t changed = 0;
         for(auto& [key,value] : _diagnostic_client->get_publish_requests())
-            send_notification("textDocument/publishDiagnostics", *value);
+        {
+            if(_emit_uri_diagnostics(key, *value))
+                changed++;
+            else
+                skipped++;
+        }
+
+        if(_pull_diagnostics)
+        {
+            if(changed > 0 && _diag_refresh_support)
+                send_request("workspace/diagnostic/refresh", [](json&) {});
+        }
+        else
+        {
+            _skipped_diag_publications += skipped;
+            spdlog::debug("Skipped {} unchanged diagnostic publications ({} overall)", skipped, _skipped_diag_publications);
+        }
 
         // It is required to send "empty" diagnostics to clear up stale diagnostics
         // on the client side.
@@ -206,6 +359,104 @@ void DiplomatLSP::_emit_diagnostics()
     }
 }
 
+/**
+ * @brief Send the diagnostics of a single URI, if they changed, 
+ * without comparing the ones of the other URIs.
+ * 
+ * Empty diagnostics are kept by the diagnostic client until the next full emission.
+ * 
+ * @param key URI of the diagnostics, as held by the diagnostic client.
+ */
+void DiplomatLSP::_emit_diagnostics(const std::string& key)
+{
+    if(! _diagnostic_client)
+        return;
+
+    const auto& publications = _diagnostic_client->get_publish_requests();
+    auto pub = publications.find(key);
+    if(pub == publications.end())
+        return;
+
+    if(_emit_uri_diagnostics(key, *pub->second))
+    {
+        if(_pull_diagnostics && _diag_refresh_support)
+            send_request("workspace/diagnostic/refresh", [](json&) {});
+    }
+    else if(! _pull_diagnostics)
+        _skipped_diag_publications++;
+}
+
+/**
+ * @brief Send the diagnostics of a single URI if they changed since the last publication.
+ * 
+ * @param key URI of the diagnostics, as held by the diagnostic client.
+ * @param pub Diagnostics of the URI.
+ * @return true if the diagnostics changed, false if the publication was skipped.
+ */
+bool DiplomatLSP::_emit_uri_diagnostics(const std::string& key, const slsp::types::PublishDiagnosticsParams& pub)
+{
+    auto prev = _published_diag_hashes.find(key);
+    if(pub.diagnostics.empty())
+    {
+        if(prev == _published_diag_hashes.end())
+            return false;
+        _published_diag_hashes.erase(prev);
+    }
+    else
+    {
+        const std::uint64_t hash = _diagnostic_client->diagnostics_hash(key);
+        if(prev != _published_diag_hashes.end() && prev->second == hash)
+            return false;
+        _published_diag_hashes[key] = hash;
+    }
+
+    if(! _pull_diagnostics)
+        send_notification("textDocument/publishDiagnostics", json(pub));
+    return true;
+}
+
+/**
+ * First level of the diagnostics: the document is parsed on its own, with a throw-away
+ * source manager, and its syntax diagnostics replace the ones of the last compilation.
+ * The semantic diagnostics of the document, and the diagnostics of the other documents,
+ * are kept until the next compilation replaces them all. Only the diagnostics of 
+ * the document are published again.
+ */
+void DiplomatLSP::_publish_syntax_diagnostics(const fs::path& path, const std::string& content)
+{
+    if(! _diagnostic_client)
+        return;
+
+    try
+    {
+        slang::SourceManager sm;
+        for(const std::string& dir : _include_dirs())
+            sm.addUserDirectories(dir);
+
+        slang::SourceBuffer buffer = sm.assignText(path.generic_string(), content);
+        std::shared_ptr<slang::syntax::SyntaxTree> tree = slang::syntax::SyntaxTree::fromBuffer(buffer, sm);
+
+        auto syntax_client = std::make_shared<slsp::LSPDiagnosticClient>(_cache, &sm);
+        slang::DiagnosticEngine de(sm);
+        de.addClient(syntax_client);
+        for(const slang::Diagnostic& diag : tree->diagnostics())
+            de.issue(diag);
+
+        const std::string key = _cache.get_uri(path).to_string();
+        std::vector<slsp::types::Diagnostic> syntax_diags;
+        const auto& publications = syntax_client->get_publish_requests();
+        if(auto pub = publications.find(key); pub != publications.end())
+            syntax_diags = pub->second->diagnostics;
+
+        _diagnostic_client->replace_syntax_diagnostics(key, std::move(syntax_diags));
+        _emit_diagnostics(key);
+    }
+    catch(const std::exception& e)
+    {
+        spdlog::warn("Unable to get the syntax diagnostics of {}: {}", path.generic_string(), e.what());
+    }
+}
+
 /**
  * @brief Delete all diagnostics and immediately send the erase to the client.
  * 
@@ -220,6 +471,36 @@ void DiplomatLSP::_erase_diagnostics()
 
 }
 
+std::string DiplomatLSP::_diagnostic_uri(const std::string& client_uri) const
+{
+    if(_published_diag_hashes.contains(client_uri))
+        return client_uri;
+    return _cache.get_uri(fs::path("/" + uri(client_uri).get_path())).to_string();
+}
+
+/**
+ * The result ID is the hash of the last publication of the document, 
+ * or zero when it has no diagnostics.
+ */
+json DiplomatLSP::_diagnostic_report(const std::string& doc_uri, const std::optional<std::string>& previous_id) const
+{
+    auto found = _published_diag_hashes.find(doc_uri);
+    const std::string result_id = fmt::format("{:016x}", found == _published_diag_hashes.end() ? 0 : found->second);
+
+    if(previous_id && previous_id.value() == result_id)
+        return json{{"kind", "unchanged"}, {"resultId", result_id}};
+
+    json items = json::array();
+    if(found != _published_diag_hashes.end() && _diagnostic_client)
+    {
+        const auto& publications = _diagnostic_client->get_publish_requests();
+        auto pub = publications.find(doc_uri);
+        if(pub != publications.end())
+            items = pub->second->diagnostics;
+    }
+    return json{{"kind", "full"}, {"resultId", result_id}, {"items", items}};
+}
+
 diplomat::index::IndexLocation DiplomatLSP::_lsp_to_index_location(const slsp::types::TextDocumentPositionParams& loc)
 {
     fs::path source_path = fs::path("/" + uri(loc.textDocument.uri).get_path());
@@ -234,7 +515,7 @@ slsp::types::Location DiplomatLSP::_index_range_to_lsp(const diplomat::index::In
     
     result.range.end.line      = loc.end.line -1;
     result.range.end.character = loc.end.column -1;
-    result.uri = _cache.get_uri(loc.start.file).to_string();
+    result.uri = _cache.get_uri(loc.start.file()).to_string();
     return result;
 }
 
@@ -253,6 +534,7 @@ void DiplomatLSP::_add_workspace_folders(const std::vector<WorkspaceFolder>& to_
         _cache.set_workspace_root(path);
         _settings.workspace_dirs.emplace(fs::path("/" + path.get_path()));
     }
+    _ws_scan_valid = false;
 }
 
 /**
@@ -268,21 +550,25 @@ void DiplomatLSP::_remove_workspace_folders(const std::vector<WorkspaceFolder>&
         spdlog::info("Remove workspace {} ({}) to working directories.", wf.name, wf.uri);
         _settings.workspace_dirs.erase( "/" + path.get_path());
     }
+    _ws_scan_valid = false;
 }
 
 
 /**
  * @brief Read the whole workspace to extract the modules names and blackbox definitions.
  * Does not elaborate, nor generate the index, diagnostics and such.
+ * 
+ * The candidate files are listed here, the ones to parse are returned to be processed 
+ * in parallel by the cache.
  */
-void DiplomatLSP::_read_workspace_modules()
+diplomat::cache::DiplomatDocumentCache::FileBatch DiplomatLSP::_read_workspace_modules()
 {
     log(MessageType_Info, "Reading workspace");
 
     namespace fs = fs;
 
     fs::path p;
-    _cache.enable_shared_source_manager();
+    std::vector<fs::path> candidates;
     for (const fs::path& root : _settings.workspace_dirs)
     {
         fs::recursive_directory_iterator it(root);
@@ -300,23 +586,7 @@ void DiplomatLSP::_read_workspace_modules()
             if(! skipped)
             {
                 std::string path = _cache.standardize_path(file.path()).generic_string();// fs::weakly_canonical(file.path()).generic_string();
-                
-                // Check for explicitely excluded paths (fast)
-                if (_settings.excluded_paths.contains(path))
-                    skipped = true;
-                
-                //! Check, if needed, for the exclusion patterns.
-                if (!skipped)
-                {
-                    for(const std::regex& rgx : _settings.excluded_regexs)
-                    {   
-                        if (std::regex_match(path,rgx))
-                        {
-                            skipped = true;
-                            break;
-                        }
-                    }
-                }
+                skipped = _settings.is_excluded(path);
             }
             
             if(skipped)
@@ -329,12 +599,167 @@ void DiplomatLSP::_read_workspace_modules()
 
             if (file.is_regular_file() && (_accepted_extensions.contains((p = file.path()).extension())))
             {
-                _cache.process_file(p);
+                candidates.push_back(p);
+            }
+        }
+    }
+
+    std::optional<fs::path> cache_path = _disk_cache_path();
+    if(cache_path && ! _disk_cache_loaded)
+    {
+        _disk_cache_loaded = true;
+        _cache.load_disk_cache(cache_path.value(),_disk_cache_version());
+    }
+
+    return _cache.prepare_files(candidates, false);
+}
+
+std::vector<std::string> DiplomatLSP::_include_dirs() const
+{
+    std::vector<std::string> include_dirs(_included_folders);
+    include_dirs.insert(include_dirs.end(), _settings.includes.system.cbegin(), _settings.includes.system.cend());
+    include_dirs.insert(include_dirs.end(), _settings.includes.user.cbegin(), _settings.includes.user.cend());
+    return include_dirs;
+}
+
+void DiplomatLSP::_sync_open_documents()
+{
+    for(const fs::path& path : _unsynced_documents)
+    {
+        auto doc = _open_documents.find(path);
+        if(doc != _open_documents.end())
+            _tree_cache.set_overlay(path, doc->second.text());
+    }
+    _unsynced_documents.clear();
+}
+
+void DiplomatLSP::_sync_workspace_modules()
+{
+    diplomat::cache::DiplomatDocumentCache::FileBatch batch = _prepare_workspace_modules();
+    diplomat::cache::DiplomatDocumentCache::extract_files(batch, _settings.parse_threads);
+    _merge_workspace_modules(batch);
+}
+
+diplomat::cache::DiplomatDocumentCache::FileBatch DiplomatLSP::_prepare_workspace_modules()
+{
+    diplomat::cache::DiplomatDocumentCache::FileBatch batch;
+    if(_ws_scan_valid && _ws_watcher.is_running() && _apply_workspace_events(batch))
+        return batch;
+
+    // The watch is started before the scan so that no modification is missed.
+    // Exclusions are copied, as the filter is run by the watcher thread.
+    _ws_scan_valid = _ws_watcher.start(_settings.workspace_dirs,
+        [settings = _settings](const fs::path& p) {
+            return settings.is_excluded(p.lexically_normal().generic_string());
+        }
+    );
+
+    return _read_workspace_modules();
+}
+
+void DiplomatLSP::_merge_workspace_modules(diplomat::cache::DiplomatDocumentCache::FileBatch& batch)
+{
+    _cache.merge_files(batch);
+
+    if(std::optional<fs::path> cache_path = _disk_cache_path())
+        _cache.save_disk_cache(cache_path.value(),_disk_cache_version());
+}
+
+bool DiplomatLSP::_apply_workspace_events(diplomat::cache::DiplomatDocumentCache::FileBatch& batch)
+{
+    using EventKind = diplomat::cache::WorkspaceWatcher::EventKind;
+
+    std::vector<diplomat::cache::WorkspaceWatcher::Event> events = _ws_watcher.take_events();
+    if(events.empty())
+        return true;
+
+    std::set<fs::path> changed;
+    std::set<fs::path> removed;
+    for(const auto& evt : events)
+    {
+        if(evt.kind == EventKind::Overflow)
+            return false;
+
+        fs::path path = _cache.standardize_path(evt.path);
+        if(evt.kind == EventKind::Changed)
+        {
+            removed.erase(path);
+            changed.insert(path);
+        }
+        else
+        {
+            changed.erase(path);
+            removed.insert(path);
+        }
+    }
+
+    spdlog::debug("Apply {} workspace modifications", changed.size() + removed.size());
+
+    // Removed paths may be directories: drop every cached file below them.
+    std::vector<fs::path> to_remove;
+    for(const fs::path& file : _cache.get_files_ws())
+    {
+        const std::string file_str = file.generic_string();
+        for(const fs::path& rm : removed)
+        {
+            const std::string rm_str = rm.generic_string();
+            if(file_str == rm_str || (file_str.starts_with(rm_str) && file_str[rm_str.length()] == '/'))
+            {
+                to_remove.push_back(file);
+                break;
             }
         }
     }
+    for(const fs::path& file : to_remove)
+        _cache.remove_file(file);
+
+    std::vector<fs::path> to_process;
+    std::error_code ec;
+    for(const fs::path& file : changed)
+    {
+        if(_accepted_extensions.contains(file.extension()) 
+            && fs::is_regular_file(file, ec) 
+            && ! _settings.is_excluded(file.generic_string()))
+            to_process.push_back(file);
+    }
+    batch = _cache.prepare_files(to_process, false);
+    return true;
+}
 
-    _cache.disable_shared_source_manager();
+std::optional<fs::path> DiplomatLSP::_disk_cache_path() const
+{
+    if(_settings.workspace_dirs.empty())
+        return {};
+
+    fs::path cache_root;
+    if(const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && xdg[0] != '\0')
+        cache_root = xdg;
+    else if(const char* home = std::getenv("HOME"); home && home[0] != '\0')
+        cache_root = fs::path(home) / ".cache";
+    else
+        return {};
+
+    // Sorted to get the same name whatever the order of the workspace folders.
+    std::set<std::string> roots;
+    for(const fs::path& root : _settings.workspace_dirs)
+        roots.insert(root.generic_string());
+
+    std::string key;
+    for(const std::string& root : roots)
+        key += root + "\n";
+
+    return cache_root / "diplomat" / fmt::format("{:016x}.json",diplomat::cache::DiplomatDocumentCache::hash_content(key));
+}
+
+std::string DiplomatLSP::_disk_cache_version()
+{
+    return fmt::format("{}-{}-slang-{}.{}.{}+{}",
+        DISK_CACHE_FORMAT,
+        DIPLOMAT_VERSION_STRING,
+        slang::VersionInfo::getMajor(),
+        slang::VersionInfo::getMinor(),
+        slang::VersionInfo::getPatch(),
+        slang::VersionInfo::getHash());
 }
 
 
@@ -344,12 +769,12 @@ void DiplomatLSP::_read_workspace_modules()
  * 
  * Thus, allowing a partial and faster refresh of the blackbox views.
  */
-void DiplomatLSP::_read_filetree_modules()
+diplomat::cache::DiplomatDocumentCache::FileBatch DiplomatLSP::_read_filetree_modules()
 {
     log(MessageType_Info, "Reading filetree");
 
-
-    _cache.refresh(true);
+    const std::set<fs::path>& prj_files = _cache.get_files_prj();
+    return _cache.prepare_files(std::vector<fs::path>(prj_files.cbegin(), prj_files.cend()), true);
 }
 
 
@@ -375,13 +800,30 @@ const ModuleBlackBox* DiplomatLSP::_bb_from_module(const std::string& module) co
  */
 void DiplomatLSP::_compute_project_tree(bool keep_tree)
 {
-    spdlog::info("Rebuild project file tree");
     if(! keep_tree)
         _clear_project_tree();
     // A top level shall be set beforehand.
     if(! _settings.top_level)
         return;
-    _add_module_to_project_tree(_settings.top_level.value());
+    _record_project_tree(_list_project_tree(_settings.top_level.value()));
+}
+
+/**
+ * The cache is only read, so that the tree may be listed while holding #_state_access shared.
+ */
+std::set<fs::path> DiplomatLSP::_list_project_tree(const std::string& top) const
+{
+    spdlog::info("Rebuild project file tree");
+    std::set<fs::path> files;
+    std::unordered_set<std::string> modules;
+    _add_module_to_project_tree(top, files, modules);
+    return files;
+}
+
+void DiplomatLSP::_record_project_tree(const std::set<fs::path>& files)
+{
+    for(const fs::path& file : files)
+        _cache.record_file(file, true);
     _project_file_tree_valid = true;
 }
 
@@ -401,8 +843,10 @@ void DiplomatLSP::_clear_project_tree()
  * This is a recursive function used to build the whole filetree of the project.
  * 
  * @param mod name of the module to add to the project tree.
+ * @param files Project files listed so far.
+ * @param modules Modules of the listed files, which are not walked again.
  */
-void DiplomatLSP::_add_module_to_project_tree(const std::string& mod)
+void DiplomatLSP::_add_module_to_project_tree(const std::string& mod, std::set<fs::path>& files, std::unordered_set<std::string>& modules) const
 {
     // The workspace modules list shall have been computed beforehand.
     // Select the SVDocument from the module name to retrieve its dependencies.
@@ -412,162 +856,773 @@ void DiplomatLSP::_add_module_to_project_tree(const std::string& mod)
     // In this case it is just skipped. 
     if(bb != nullptr)
     {
-
-        // No problem with re-inserting, moreover, this will also insert all modules of the file.
-        _cache.record_file(_cache.get_file_from_module(bb),true);
+        // Once recorded, all modules of the file will be part of the project.
+        modules.insert(bb->module_name);
+        const fs::path file = _cache.get_file_from_module(bb);
+        if(files.insert(file).second)
+        {
+            if(const std::vector<const ModuleBlackBox*>* file_bbs = _cache.get_bb_by_file(file))
+            {
+                for(const ModuleBlackBox* file_bb : *file_bbs)
+                    modules.insert(file_bb->module_name);
+            }
+        }
 
         for(const std::string& dep : bb->deps)
         {
-            if(!_cache.got_module_in_project(dep))
+            if(!_cache.got_module_in_project(dep) && ! modules.contains(dep))
             {
-                _add_module_to_project_tree(dep);
+                _add_module_to_project_tree(dep, files, modules);
             }
         }
     }
 }
 
+void DiplomatLSP::_request_compile()
+{
+    {
+        std::lock_guard<std::mutex> lock(_compile_access);
+        _compile_requested = true;
+        _compile_generation++;
+    }
+    _compile_cv.notify_one();
+}
+
+bool DiplomatLSP::_is_superseded(std::uint64_t generation) const
+{
+    return generation != _compile_generation.load() || _compile_worker.get_stop_token().stop_requested();
+}
+
+/**
+ * Waits for a compilation request, then waits for #_compile_debounce without any 
+ * new request before actually starting the compilation. 
+ * Requests issued while a compilation is running will trigger a new compilation 
+ * as soon as the running one is done or abandoned.
+ */
+void DiplomatLSP::_compile_loop(std::stop_token stok)
+{
+    // Writing to a compilation process that died shall fail with EPIPE
+    // instead of killing the server.
+    sigset_t sigpipe;
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe, nullptr);
+
+    while(! stok.stop_requested())
+    {
+        std::uint64_t generation;
+        {
+            std::unique_lock lock(_compile_access);
+            if(! _compile_cv.wait(lock, stok, [this] { return _compile_requested; }))
+                break;
+
+            // Debounce: restart the wait as long as new requests arrive.
+            do
+            {
+                generation = _compile_generation;
+            } while (_compile_cv.wait_for(lock, stok, _compile_debounce, 
+                        [this, generation] { return _compile_generation != generation; }));
+
+            if(stok.stop_requested())
+                break;
+
+            _compile_requested = false;
+        }
+
+        try
+        {
+            if(! _compile(generation))
+                spdlog::info("Compilation {} superseded, abandoned.", generation);
+        }
+        catch(const std::exception& e)
+        {
+            spdlog::error("Compilation failed: {}", e.what());
+        }
+    }
+    spdlog::info("Stop compilation thread.");
+}
+
 /**
- * @brief Performs all steps of the compilation and elaboration of the design, 
- * including diagnostic emission.
+ * This is run by the compilation thread. The server state is only locked while 
+ * reading the inputs and publishing the results, so that read-only requests
+ * may still be processed against the previous index.
+ * 
+ * The modified workspace files are selected while holding the lock, then parsed
+ * without it, and merged in the cache under the lock again. The project tree is 
+ * then listed along the read-only requests and recorded with the other inputs.
+ * 
+ * Superseding is checked at each phase boundary (parse, elaboration, 
+ * indexing, references, analysis) and before publishing the results, 
+ * so that only the last generation publishes its diagnostics.
+ *
+ * When the analysis is deferred, the compilation and its diagnostics are published
+ * before running it, and the analysis diagnostics are sent in a second publication.
+ *
+ * When compiling in a child process, the job is prepared while reading the inputs,
+ * then the child is started and the server only waits for its results.
  */
-void DiplomatLSP::_compile()
+bool DiplomatLSP::_compile(std::uint64_t generation)
 {
     spdlog::info("Request design compilation");
+
+    std::vector<fs::path> files;
+    slang::analysis::AnalysisOptions aoptions;
+    bool defer_analysis;
+    json worker_job;
+    unsigned int memory_limit = 0;
+    slang::ast::CompilationOptions coptions;
+    diplomat::cache::DiplomatDocumentCache::FileBatch batch;
+    unsigned int parse_threads;
+    bool scan_workspace;
+    std::optional<std::string> top_level;
+
+    {
+        std::unique_lock lock(_state_access);
+
+        // Set before reading the modules, as the files to compile 
+        // are parsed in the tree cache at this step.
+        if(_reset_tree_cache.exchange(false))
+            _tree_cache.clear();
+        _tree_cache.set_include_dirs(_include_dirs());
+        parse_threads = _settings.parse_threads;
+        _tree_cache.set_parse_threads(parse_threads);
+        top_level = _settings.top_level;
+        _cache.set_tree_store(&_tree_cache, ! top_level.has_value());
+        _sync_open_documents();
         
-    if(!_project_file_tree_valid)
-        _read_workspace_modules();
-    else
-        _read_filetree_modules();
+        scan_workspace = ! _project_file_tree_valid;
+        if(scan_workspace)
+            batch = _prepare_workspace_modules();
+        else
+            batch = _read_filetree_modules();
+    }
 
-    // As per slang limitation, it is needed to recreate the diagnostic engine
-    // because the source manager will be deleted by _read_workspace_modules.
-    // Therefore, the client shall also be rebuilt.
-    _sm.reset(new slang::SourceManager());
-    
-    for(auto dir : _included_folders)
-        _sm->addUserDirectories(dir);
-    for(auto dir : _settings.includes.system )
-        _sm->addUserDirectories(dir);
-    for(auto dir : _settings.includes.user )
-        _sm->addUserDirectories(dir);
+    diplomat::cache::DiplomatDocumentCache::extract_files(batch, parse_threads);
+
+    bool list_project_tree;
+    {
+        // Always merged, as the outdated records were dropped when selecting the files.
+        std::unique_lock lock(_state_access);
+        if(scan_workspace)
+            _merge_workspace_modules(batch);
+        else
+            _cache.merge_files(batch);
+
+        // If the filetree has not been provided
+        // Try to auto-compute it.
+        list_project_tree = top_level && ! _project_file_tree_valid;
+    }
+
+    std::set<fs::path> project_tree;
+    if(list_project_tree && ! _is_superseded(generation))
+    {
+        std::shared_lock lock(_state_access);
+        project_tree = _list_project_tree(top_level.value());
+    }
+
+    {
+        std::unique_lock lock(_state_access);
+
+        // The settings may have been changed meanwhile, in which case a new
+        // compilation has been requested.
+        if(_is_superseded(generation))
+            return false;
+
+        aoptions.numThreads = _settings.analysis_threads;
+        defer_analysis = _settings.defer_analysis;
+        coptions = compilation_options(top_level);
+        if (top_level)
+        {
+            spdlog::info("Top-level is {}",top_level.value());
+
+            if(list_project_tree && ! _project_file_tree_valid)
+                _record_project_tree(project_tree);
+
+            spdlog::info("Add syntax trees from project file tree");
+            files.assign(_cache.get_files_prj().cbegin(),_cache.get_files_prj().cend());
+        }
+        else
+        {
+            spdlog::info("Add syntax trees from workspace");
+            files.assign(_cache.get_files_ws().cbegin(),_cache.get_files_ws().cend());
+        }
+
+        if(_settings.compile_in_subprocess)
+        {
+            memory_limit = _settings.compile_memory_limit;
+
+            // The child process has its own tree cache, which only gets the open documents.
+            std::vector<std::string> file_names;
+            json overlays = json::object();
+            for(const fs::path& path : files)
+            {
+                file_names.push_back(path.generic_string());
+                if(auto doc = _open_documents.find(path); doc != _open_documents.end())
+                    overlays[path.generic_string()] = doc->second.text();
+            }
+
+            worker_job = {
+                {"generation", generation},
+                {"workspace_root", _cache.get_workspace_root()},
+                {"include_dirs", _include_dirs()},
+                {"parse_threads", _settings.parse_threads},
+                {"overlays", std::move(overlays)},
+                {"files", std::move(file_names)},
+                {"top_level", top_level ? json(top_level.value()) : json()},
+                {"analysis_threads", aoptions.numThreads},
+                {"defer_analysis", defer_analysis}};
+        }
+    }
+
+    if(! worker_job.is_null())
+    {
+        int worker_fd = -1;
+        pid_t worker = _spawn_compile_worker(worker_job, worker_fd);
+        if(worker > 0)
+            return _await_compile_worker(generation, worker, worker_fd, memory_limit);
+        spdlog::warn("Unable to start the compilation process, compile in the server.");
+    }
 
-    _diagnostic_client.reset(new slsp::LSPDiagnosticClient(_cache,_sm.get(),_diagnostic_client.get()));
+    if(_is_superseded(generation))
+        return false;
 
+    return _compile_design(generation, files, coptions, aoptions, parse_threads, defer_analysis);
+}
 
-    slang::DiagnosticEngine de = slang::DiagnosticEngine(*_sm);
+bool DiplomatLSP::_compile_design(std::uint64_t generation, 
+    const std::vector<fs::path>& files, 
+    const slang::ast::CompilationOptions& coptions, 
+    const slang::analysis::AnalysisOptions& aoptions,
+    unsigned int parse_threads,
+    bool defer_analysis)
+{
+    // The source manager is owned by the syntax tree cache, and may be replaced
+    // from one compilation to the next. Therefore, the diagnostic client 
+    // shall also be rebuilt.
+    std::shared_ptr<slang::SourceManager> sm;
+    std::shared_ptr<slsp::LSPDiagnosticClient> diagnostic_client;
+
+    // Only new and modified files are actually parsed.
+    diplomat::cache::SyntaxTreeCache::TreeSet trees = _tree_cache.get_trees(files, true);
+    sm = trees.sm;
+    {
+        auto lock = _shared_state_lock();
+        diagnostic_client.reset(new slsp::LSPDiagnosticClient(_cache,sm.get(),_diagnostic_client.get()));
+    }
+
+    slang::DiagnosticEngine de = slang::DiagnosticEngine(*sm);
     
     de.setErrorLimit(500);
     de.setIgnoreAllWarnings(false);
     de.setSeverity(slang::diag::MismatchedTimeScales,slang::DiagnosticSeverity::Ignored);
     de.setSeverity(slang::diag::MissingTimeScale,slang::DiagnosticSeverity::Ignored);
     de.setSeverity(slang::diag::UnusedDefinition,slang::DiagnosticSeverity::Ignored);
-    de.addClient(_diagnostic_client);
+    de.addClient(diagnostic_client);
 
-    slang::ast::CompilationOptions coptions;
-    coptions.flags = slang::ast::CompilationFlags::AllowHierarchicalConst 
-    | slang::ast::CompilationFlags::AllowTopLevelIfacePorts ;
+    //coptions.flags |= slang::ast::CompilationFlags::IgnoreUnknownModules;
+    slang::Bag bag(coptions);
+
+    // Regenerate compilation object to allow for a "recompilation".
+    std::unique_ptr<slang::ast::Compilation> compilation(new slang::ast::Compilation(bag));
+
+    for (const auto& st : trees.trees)
+    {
+        if(st)
+            compilation->addSyntaxTree(st);
+    }
+
+    if(_is_superseded(generation))
+        return false;
+
+    // Actually compile and elaborate the design
+    compilation->getRoot();
+
+    if(_is_superseded(generation))
+        return false;
 
     
-    if (_settings.top_level)
+    spdlog::info("Issuing diagnostics");
     {
-        spdlog::info("Top-level is {}",_settings.top_level.value());
-        coptions.topModules = {_settings.top_level.value()};
+        // The diagnostic client looks up the URIs in the cache.
+        auto lock = _shared_state_lock();
+        for (const slang::Diagnostic& diag : compilation->getAllDiagnostics())
+            de.issue(diag);
     }
-    //coptions.flags |= slang::ast::CompilationFlags::IgnoreUnknownModules;
-    slang::Bag bag(coptions);
+    
 
-    // Regenerate compilation object to allow for a "recompilation".
-    _compilation.reset(new slang::ast::Compilation(bag));
+    spdlog::info("Run indexer");
+    
+    std::shared_ptr<diplomat::index::IndexCore> new_index;
+    diplomat::index::IndexVisitor idx_visit(compilation->getSourceManager());
+    try
+    {
+        spdlog::info("Processing symbols and hierarchy");
+        compilation->getRoot().visit(idx_visit);
+        new_index = idx_visit.get_index();
+
+        if(_is_superseded(generation))
+            return false;
+
+        spdlog::info("Processing references");
 
+        if(! new_index->process_references(*compilation->getSourceManager(), parse_threads,
+            [this, generation]() { return _is_superseded(generation); }))
+            return false;
 
-    if(_settings.top_level)
+        // From now on, the index does not depend on the compilation anymore.
+        new_index->release_syntax();
+        new_index->freeze_references();
+    }
+    catch(const std::runtime_error & e)
     {
-        // If the filetree has not been provided
-        // Try to auto-compute it.
-        if(! _project_file_tree_valid)
-            _compute_project_tree();
+        new_index.reset();
+        spdlog::error("Indexing error {}", e.what());
+    }
+
+    if(_is_superseded(generation))
+        return false;
+
+    spdlog::info("Capture design hierarchy");
+    json hierarchy;
+    {
+        // The hierarchy visitor looks up the URIs in the cache.
+        auto lock = _shared_state_lock();
+        HierVisitor hier_visitor(false,&_cache);
+        compilation->getRoot().visit(hier_visitor);
+        hierarchy = hier_visitor.get_hierarchy();
+    }
+
+    compilation->freeze();
+
+    // Elaboration and indexing results are made available before the analysis, 
+    // which may be long on big designs.
+    if(defer_analysis && ! _publish_compilation(generation, std::move(hierarchy), sm, diagnostic_client, std::move(new_index)))
+        return false;
 
-        spdlog::info("Add syntax trees from project file tree");
-        for (const auto& file : _cache.get_files_prj())
+    spdlog::info("Running analysis");
+    slang::analysis::AnalysisManager ana_mgr(aoptions);
+    ana_mgr.analyze(*compilation);
+
+    if(_is_superseded(generation))
+        return false;
+
+    if(defer_analysis && _compile_worker_fd >= 0)
+    {
+        // The server already got the compilation diagnostics, only send the new ones.
+        const std::unordered_map<std::string, std::size_t> published = diagnostic_client->count_diagnostics();
+        for (const slang::Diagnostic& diag : ana_mgr.getDiagnostics(sm.get()))
+            de.issue(diag);
+
+        _send_to_server(json{{"kind", "analysis"}, {"diagnostics", diagnostic_client->export_diagnostics(published)}});
+    }
+    else if(defer_analysis)
+    {
+        // The diagnostic client is already published at this point.
+        std::unique_lock lock(_state_access);
+        if(_is_superseded(generation))
+            return false;
+
+        for (const slang::Diagnostic& diag : ana_mgr.getDiagnostics(sm.get()))
+            de.issue(diag);
+
+        spdlog::info("Send analysis diagnostics");
+        _emit_diagnostics();
+    }
+    else
+    {
         {
-            spdlog::debug("    Reading file {}",file.generic_string());
-            auto st = slang::syntax::SyntaxTree::fromFile(file.generic_string(),*_sm);
-            if(st.has_value())
-                _compilation->addSyntaxTree(st.value());
+            auto lock = _shared_state_lock();
+            for (const slang::Diagnostic& diag : ana_mgr.getDiagnostics(sm.get()))
+                de.issue(diag);
         }
+
+        // Nothing refers to the compilation anymore.
+        compilation.reset();
+
+        if(! _publish_compilation(generation, std::move(hierarchy), sm, diagnostic_client, std::move(new_index)))
+            return false;
     }
-    else
+
+    spdlog::info("Compilation done.");
+    return true;
+}
+
+/**
+ * The compilation process is a new instance of the server executable, started with 
+ * `posix_spawn`, such that it does not inherit anything from the server threads (the locks
+ * they hold in particular). Its job is written on its standard input, and it sends its results
+ * through another pipe. Its standard output is redirected to `/dev/null`, so that nothing can
+ * reach the client.
+ */
+pid_t DiplomatLSP::_spawn_compile_worker(const json& job, int& read_fd)
+{
+    int job_fds[2];
+    int result_fds[2];
+    if(pipe2(job_fds, O_CLOEXEC) != 0)
     {
-        spdlog::info("Add syntax trees from workspace");    
-        for (const auto& file : _cache.get_files_ws())
+        spdlog::error("Unable to create the compilation pipe: {}", std::strerror(errno));
+        return -1;
+    }
+    if(pipe2(result_fds, O_CLOEXEC) != 0)
+    {
+        spdlog::error("Unable to create the compilation pipe: {}", std::strerror(errno));
+        close(job_fds[0]);
+        close(job_fds[1]);
+        return -1;
+    }
+
+    // Duplicating a descriptor onto itself would keep its close-on-exec flag.
+    if(result_fds[1] == COMPILE_WORKER_RESULT_FD)
+    {
+        int moved = fcntl(result_fds[1], F_DUPFD_CLOEXEC, COMPILE_WORKER_RESULT_FD + 1);
+        if(moved < 0)
         {
-             auto st = slang::syntax::SyntaxTree::fromFile(file.generic_string(),*_sm);
-            if(st.has_value())
-                _compilation->addSyntaxTree(st.value());
+            spdlog::error("Unable to create the compilation pipe: {}", std::strerror(errno));
+            for(int fd : {job_fds[0], job_fds[1], result_fds[0], result_fds[1]})
+                close(fd);
+            return -1;
         }
+        close(result_fds[1]);
+        result_fds[1] = moved;
     }
 
-    // Actually compile and elaborate the design
-    _compilation->getRoot();
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, job_fds[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, result_fds[1], COMPILE_WORKER_RESULT_FD);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
 
-    
-    spdlog::info("Issuing diagnostics");
-    for (const slang::Diagnostic& diag : _compilation->getAllDiagnostics())
-        de.issue(diag);
-    
+    pid_t pid = -1;
+    char* argv[] = {const_cast<char*>("diplomat-server"), const_cast<char*>(compile_worker_flag), nullptr};
+    int err = posix_spawn(&pid, "/proc/self/exe", &actions, nullptr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(job_fds[0]);
+    close(result_fds[1]);
+
+    if(err != 0)
+    {
+        spdlog::error("Unable to start the compilation process: {}", std::strerror(err));
+        close(job_fds[1]);
+        close(result_fds[0]);
+        return -1;
+    }
+
+    // The child reads its whole job before doing anything else.
+    std::vector<std::uint8_t> content = json::to_msgpack(job);
+    std::size_t written = 0;
+    while(written < content.size())
+    {
+        ssize_t ret = write(job_fds[1], content.data() + written, content.size() - written);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret < 0)
+        {
+            spdlog::error("Unable to send its job to the compilation process: {}", std::strerror(errno));
+            close(job_fds[1]);
+            close(result_fds[0]);
+            kill(pid, SIGKILL);
+            while(waitpid(pid, nullptr, 0) < 0 && errno == EINTR);
+            return -1;
+        }
+        written += ret;
+    }
+    close(job_fds[1]);
+
+    spdlog::info("Compilation {} runs in process {}", job.at("generation").template get<std::uint64_t>(), pid);
+    read_fd = result_fds[0];
+    return pid;
+}
+
+/**
+ * The job is read until the end of the standard input. The server instance has no client:
+ * it is only used to run #_compile_design, which sends its results to the server process.
+ * 
+ * The memory limit is enforced by the server process, see #_await_compile_worker.
+ */
+int DiplomatLSP::run_compile_worker()
+{
+    // Nothing shall be logged by the compilation process.
+    spdlog::default_logger_raw()->set_level(spdlog::level::off);
+
+    std::string input;
+    std::vector<char> chunk(COMPILE_WORKER_READ_SIZE);
+    while(true)
+    {
+        ssize_t nread = read(STDIN_FILENO, chunk.data(), chunk.size());
+        if(nread < 0 && errno == EINTR)
+            continue;
+        if(nread < 0)
+            return COMPILE_WORKER_FAILED;
+        if(nread == 0)
+            break;
+        input.append(chunk.data(), nread);
+    }
 
-    spdlog::info("Run indexer");
-    
-   diplomat::index::IndexVisitor idx_visit(_compilation->getSourceManager());
     try
     {
-        spdlog::info("Processing symbols and hierarchy");
-        _compilation->getRoot().visit(idx_visit);
-        _index = std::move(idx_visit.get_index());
-        spdlog::info("Processing references");
+        json job = json::from_msgpack(input);
+        input = std::string();
 
-        for(const auto& file : _index->get_indexed_files())
+        std::istringstream no_input;
+        std::ostream no_output(nullptr);
+        DiplomatLSP worker(no_input, no_output, false, COMPILE_WORKER_RESULT_FD);
+        worker._run_compile_job(job);
+    }
+    catch(const std::bad_alloc&)
+    {
+        return COMPILE_WORKER_OUT_OF_MEMORY;
+    }
+    catch(...)
+    {
+        return COMPILE_WORKER_FAILED;
+    }
+    return 0;
+}
+
+void DiplomatLSP::_run_compile_job(const json& job)
+{
+    const std::uint64_t generation = job.at("generation").template get<std::uint64_t>();
+    _compile_generation = generation;
+
+    const std::string root = job.at("workspace_root").template get<std::string>();
+    if(! root.empty())
+    {
+        uri root_uri(fmt::format("file://{}", root));
+        _cache.set_workspace_root(root_uri);
+    }
+
+    _tree_cache.set_include_dirs(job.at("include_dirs").template get<std::vector<std::string>>());
+    const unsigned int parse_threads = job.at("parse_threads").template get<unsigned int>();
+    _tree_cache.set_parse_threads(parse_threads);
+    for(const auto& [path, content] : job.at("overlays").items())
+        _tree_cache.set_overlay(fs::path(path), content.template get<std::string>());
+
+    std::vector<fs::path> files;
+    for(const json& path : job.at("files"))
+        files.emplace_back(path.template get<std::string>());
+
+    std::optional<std::string> top_level;
+    if(! job.at("top_level").is_null())
+        top_level = job.at("top_level").template get<std::string>();
+
+    slang::analysis::AnalysisOptions aoptions;
+    aoptions.numThreads = job.at("analysis_threads").template get<unsigned int>();
+
+    _compile_design(generation, files, compilation_options(top_level), aoptions, parse_threads, job.at("defer_analysis").template get<bool>());
+}
+
+/**
+ * Messages are framed by their size, then decoded from MessagePack:
+ *  - `compilation`: hierarchy, serialized index and diagnostics of the compilation, 
+ *    published as the in-process compilation would do.
+ *  - `analysis`: diagnostics of a deferred analysis, added to the published ones.
+ * 
+ * The memory limit applies to the resident memory of the child process, which is 
+ * checked every #COMPILE_WORKER_POLL_PERIOD_MS. An address space limit would be hit 
+ * well before, as the allocator and the parsing threads reserve more than they use.
+ */
+bool DiplomatLSP::_await_compile_worker(std::uint64_t generation, pid_t pid, int fd, unsigned int memory_limit)
+{
+    auto stop_worker = [pid, fd]() {
+        kill(pid, SIGKILL);
+        close(fd);
+        while(waitpid(pid, nullptr, 0) < 0 && errno == EINTR);
+    };
+
+    const std::uint64_t memory_limit_bytes = static_cast<std::uint64_t>(memory_limit) * 1024 * 1024;
+    auto next_memory_check = std::chrono::steady_clock::now();
+
+    std::string pending;
+    std::vector<char> chunk(COMPILE_WORKER_READ_SIZE);
+    bool published = false;
+    bool eof = false;
+    while(! eof)
+    {
+        if(_is_superseded(generation))
         {
+            spdlog::info("Stop compilation process {}", pid);
+            stop_worker();
+            return false;
+        }
+
+        if(memory_limit > 0 && std::chrono::steady_clock::now() >= next_memory_check)
+        {
+            next_memory_check = std::chrono::steady_clock::now() + std::chrono::milliseconds(COMPILE_WORKER_POLL_PERIOD_MS);
+            std::optional<std::uint64_t> resident = process_resident_size(pid);
+            if(resident && resident.value() > memory_limit_bytes)
             {
-                spdlog::info("Processing references for {}",file->get_path().generic_string());
+                spdlog::error("Compilation process {} uses {} MiB, stop it.", pid, resident.value() / (1024 * 1024));
+                stop_worker();
+                show_message(MessageType_Error, fmt::format("Design compilation exceeded its memory limit of {} MiB.", memory_limit));
+                throw std::runtime_error("Compilation process ran out of memory");
+            }
+        }
 
-                auto stx = file->get_syntax_root();
-                if(stx)
+        pollfd pfd{fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, COMPILE_WORKER_POLL_PERIOD_MS);
+        if(ready < 0 && errno != EINTR)
+        {
+            stop_worker();
+            throw std::runtime_error(fmt::format("Unable to read the compilation process output: {}", std::strerror(errno)));
+        }
+        if(ready <= 0)
+            continue;
+
+        ssize_t nread = read(fd, chunk.data(), chunk.size());
+        if(nread < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            stop_worker();
+            throw std::runtime_error(fmt::format("Unable to read the compilation process output: {}", std::strerror(errno)));
+        }
+        eof = nread == 0;
+        pending.append(chunk.data(), nread);
+
+        std::uint64_t size;
+        while(pending.size() >= sizeof(size))
+        {
+            std::memcpy(&size, pending.data(), sizeof(size));
+            if(pending.size() - sizeof(size) < size)
+                break;
+
+            json message = json::from_msgpack(pending.begin() + sizeof(size), pending.begin() + sizeof(size) + size);
+            pending.erase(0, sizeof(size) + size);
+
+            if(message.at("kind") == "compilation")
+            {
+                std::shared_ptr<diplomat::index::IndexCore> index;
+                try
+                {
+                    if(! message.at("index").is_null())
+                        index = diplomat::index::IndexSerializer::load(message.at("index"));
+                }
+                catch(const std::exception& e)
+                {
+                    spdlog::error("Unable to load the index from the compilation process: {}", e.what());
+                }
+
+                // The compilation is not available in the server, 
+                // an empty source manager stands for its own.
+                std::shared_ptr<slang::SourceManager> sm = std::make_shared<slang::SourceManager>();
+                std::shared_ptr<slsp::LSPDiagnosticClient> diagnostic_client;
                 {
-                    diplomat::index::ReferenceVisitor ref_visitor(_compilation->getSourceManager(),_index.get());
-                    stx->visit(ref_visitor);
+                    std::shared_lock lock(_state_access);
+                    diagnostic_client.reset(new slsp::LSPDiagnosticClient(_cache,sm.get(),_diagnostic_client.get()));
                 }
-                else {
-                 spdlog::warn("No syntax node available for {}. No reference processed.", file->get_path().generic_string());
+                diagnostic_client->append_diagnostics(message.at("diagnostics"));
+
+                if(! _publish_compilation(generation, std::move(message.at("hierarchy")), sm, diagnostic_client, std::move(index)))
+                {
+                    stop_worker();
+                    return false;
+                }
+                published = true;
+            }
+            else if(message.at("kind") == "analysis")
+            {
+                std::unique_lock lock(_state_access);
+                if(_is_superseded(generation))
+                {
+                    stop_worker();
+                    return false;
                 }
+
+                _diagnostic_client->append_diagnostics(message.at("diagnostics"));
+
+                spdlog::info("Send analysis diagnostics");
+                _emit_diagnostics();
             }
         }
+    }
 
-        if(_broken_index_emitted)
+    close(fd);
+    int status = 0;
+    while(waitpid(pid, &status, 0) < 0 && errno == EINTR);
+
+    if(WIFEXITED(status) && WEXITSTATUS(status) == COMPILE_WORKER_OUT_OF_MEMORY)
+    {
+        show_message(MessageType_Error, "Design compilation ran out of memory.");
+        throw std::runtime_error("Compilation process ran out of memory");
+    }
+    else if(WIFSIGNALED(status))
+        throw std::runtime_error(fmt::format("Compilation process killed by signal {}", WTERMSIG(status)));
+    else if(! WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        throw std::runtime_error(fmt::format("Compilation process failed with code {}", WEXITSTATUS(status)));
+    else if(! published)
+        throw std::runtime_error("Compilation process exited without result");
+
+    spdlog::info("Compilation done.");
+    return true;
+}
+
+void DiplomatLSP::_send_to_server(const json& message)
+{
+    std::vector<std::uint8_t> content = json::to_msgpack(message);
+    std::uint64_t size = content.size();
+
+    std::string frame(reinterpret_cast<const char*>(&size), sizeof(size));
+    frame.append(content.begin(), content.end());
+    content.clear();
+    content.shrink_to_fit();
+
+    std::size_t written = 0;
+    while(written < frame.size())
+    {
+        ssize_t ret = write(_compile_worker_fd, frame.data() + written, frame.size() - written);
+        if(ret < 0)
         {
-            log(MessageType_Info, "Index restored");
-            _broken_index_emitted = false;
+            if(errno == EINTR)
+                continue;
+            throw std::runtime_error(fmt::format("Unable to send the compilation results: {}", std::strerror(errno)));
         }
+        written += ret;
     }
-    catch(const std::runtime_error & e)
+}
+
+std::shared_lock<std::shared_mutex> DiplomatLSP::_shared_state_lock()
+{
+    if(_compile_worker_fd >= 0)
+        return std::shared_lock<std::shared_mutex>(_state_access, std::defer_lock);
+    return std::shared_lock<std::shared_mutex>(_state_access);
+}
+
+/**
+ * In a compilation child process, the results are sent to the server process,
+ * which publishes them in turn.
+ */
+bool DiplomatLSP::_publish_compilation(std::uint64_t generation, 
+    json hierarchy, 
+    const std::shared_ptr<slang::SourceManager>& sm, 
+    const std::shared_ptr<slsp::LSPDiagnosticClient>& diagnostic_client, 
+    std::shared_ptr<diplomat::index::IndexCore> index)
+{
+    if(_compile_worker_fd >= 0)
     {
-        _index.reset();
-        spdlog::error("Indexing error {}", e.what());
+        _send_to_server(json{
+            {"kind", "compilation"},
+            {"hierarchy", std::move(hierarchy)},
+            {"index", index ? diplomat::index::IndexSerializer::save(*index) : json()},
+            {"diagnostics", diagnostic_client->export_diagnostics()}});
+        return true;
     }
 
-    _compilation->freeze();
-    spdlog::info("Running analysis");
-    slang::analysis::AnalysisManager ana_mgr;
-    ana_mgr.analyze(*_compilation);
+    std::unique_lock lock(_state_access);
 
-    for (const slang::Diagnostic& diag : ana_mgr.getDiagnostics(_sm.get()))
-        de.issue(diag);
+    // Last check, under lock, to only publish the latest generation.
+    if(_is_superseded(generation))
+        return false;
+
+    _design_hierarchy = std::move(hierarchy);
+    _sm = sm;
+    _diagnostic_client = diagnostic_client;
+    if(index && _broken_index_emitted.exchange(false))
+        log(MessageType_Info, "Index restored");
+    _set_index(std::move(index));
 
     spdlog::info("Send diagnostics");
     _emit_diagnostics();
-
-
-    spdlog::info("Compilation done.");
+    return true;
 }
 
 
@@ -598,6 +1653,8 @@ void DiplomatLSP::_save_client_uri(const std::string& client_uri)
     {
         if(_diagnostic_client->remap_diagnostic_uri(fmt::format("file://{}",abspath),client_uri))
         {
+            // The internal URI is kept in the published hashes, so that 
+            // its placeholder is sent to clear the client side.
             _emit_diagnostics();
         }
     }
@@ -652,7 +1709,7 @@ void DiplomatLSP::_save_client_uri(const std::string& client_uri)
 void DiplomatLSP::set_top_level(const std::string& new_top)
 {
     _settings.top_level = new_top;
-    _compile();
+    _request_compile();
 }
 
 
@@ -664,7 +1721,8 @@ void DiplomatLSP::hello(json _)
 
 void DiplomatLSP::dump_index(json _)
 {
-    if(! _index)
+    std::shared_ptr<diplomat::index::IndexCore> index = _get_index();
+    if(! index)
     {
         show_message(MessageType_Error, "No index is managed, dump failed.");
         log(MessageType_Error, "Index pointer does not manage anything. Dump aborted.");
@@ -673,7 +1731,7 @@ void DiplomatLSP::dump_index(json _)
     {
         fs::path opath = fs::absolute("./index_dump.json");
         std::ofstream ofile(opath);
-        ofile << std::setw(4) << _index->dump().dump(4) << std::endl;
+        ofile << std::setw(4) << index->dump().dump(4) << std::endl;
         show_message(MessageType_Info, "Index successfully dumped.");
         log(MessageType_Info, fmt::format("Index successfully dumped to {}.", opath.generic_string()));
         spdlog::info("Dumped internal index to {}",opath.generic_string());
@@ -42,7 +42,6 @@
 
 #include "uri.hh"
 
-#include "hier_visitor.h"
 #include "visitor_module_bb.hpp"
 
 #include "signal.h"
@@ -86,8 +85,10 @@ void DiplomatLSP::_h_didChangeWorkspaceFolders(json _)
 
 void DiplomatLSP::_h_didSaveTextDocument(DidSaveTextDocumentParams param)
 {
+	// The blackboxes may be extracted from the tree cache, that shall see the last content.
+	_sync_open_documents();
 	_cache.process_file(uri(param.textDocument.uri));
-	_compile();
+	_request_compile();
 }
 
 void DiplomatLSP::_h_didOpenTextDocument(json _)
@@ -95,21 +96,70 @@ void DiplomatLSP::_h_didOpenTextDocument(json _)
 	DidOpenTextDocumentParams params =  _;
 
 	_save_client_uri(params.textDocument.uri);
+
+	fs::path path = _cache.standardize_path(uri(params.textDocument.uri));
+	_open_documents.insert_or_assign(path, diplomat::cache::DocumentBuffer(params.textDocument.text, params.textDocument.version));
+	_unsynced_documents.insert(path);
 }
 
-void DiplomatLSP::_h_didCloseTextDocument(DidCloseTextDocumentParams _)
+/**
+ * @brief Apply the edits of an opened document (incremental sync).
+ * Syntax diagnostics of the document are published right away, while
+ * the full compilation is requested, and debounced.
+ * 
+ * @param params DidChangeTextDocumentParams
+ */
+void DiplomatLSP::_h_didChangeTextDocument(json params)
 {
-	/* Actually nothing to do, only bind to avoid errors*/
+	fs::path path = _cache.standardize_path(uri(params.at("textDocument").at("uri").template get<std::string>()));
+	const int version = params.at("textDocument").at("version").template get<int>();
+
+	auto doc = _open_documents.find(path);
+	if(doc == _open_documents.end())
+	{
+		spdlog::warn("Got changes for {}, which is not opened.", path.generic_string());
+		return;
+	}
+
+	for(const json& change : params.at("contentChanges"))
+	{
+		std::string text = change.at("text").template get<std::string>();
+		if(change.contains("range"))
+		{
+			const json& start = change.at("range").at("start");
+			const json& end = change.at("range").at("end");
+			doc->second.apply_change(
+				start.at("line").template get<unsigned int>(), start.at("character").template get<unsigned int>(),
+				end.at("line").template get<unsigned int>(), end.at("character").template get<unsigned int>(),
+				text, version);
+		}
+		else
+			doc->second.replace(std::move(text), version);
+	}
+	_unsynced_documents.insert(path);
+
+	_publish_syntax_diagnostics(path, doc->second.text());
+	_request_compile();
+}
+
+void DiplomatLSP::_h_didCloseTextDocument(DidCloseTextDocumentParams params)
+{
+	// Back to the content on the disk.
+	fs::path path = _cache.standardize_path(uri(params.textDocument.uri));
+	_open_documents.erase(path);
+	_unsynced_documents.erase(path);
+	_tree_cache.remove_overlay(path);
 }
 
 json DiplomatLSP::_h_completion(CompletionParams params)
 {
 	CompletionList result;
 	result.isIncomplete = false;
-	_assert_index(true);
+	std::shared_ptr<di::IndexCore> index = _get_index();
+	_assert_index(index.get(),true);
 
 	di::IndexLocation trigger_location = _lsp_to_index_location(params);
-	di::IndexScope* trigger_scope = _index->get_scope_by_position(trigger_location);
+	di::IndexScope* trigger_scope = index->get_scope_by_position(trigger_location);
 
 	if(trigger_scope)
 	{
@@ -130,7 +180,7 @@ json DiplomatLSP::_h_completion(CompletionParams params)
 		// Propose symbols from the whole file.
 
 		//spdlog::info("Required completion on full file");
-		di::IndexFile* trigger_file = _index->get_file(trigger_location.file);
+		di::IndexFile* trigger_file = index->get_file_by_id(trigger_location.file_id);
 		// This file is not known by the indexer.
 		if(! trigger_file)
 			return result; 
@@ -235,6 +285,20 @@ json DiplomatLSP::_h_initialize(InitializeParams params)
 		);
 	}
 
+	// Pull diagnostics are used whenever the client supports them.
+	if(params.capabilities.textDocument && params.capabilities.textDocument.value().diagnostic)
+	{
+		_pull_diagnostics = true;
+		capabilities.diagnosticProvider = json{
+			{"identifier", "diplomat-slang"},
+			{"interFileDependencies", true},
+			{"workspaceDiagnostics", true}
+		};
+	}
+	_diag_refresh_support = params.capabilities.workspace 
+		&& params.capabilities.workspace.value().diagnostics
+		&& params.capabilities.workspace.value().diagnostics.value().refreshSupport.value_or(false);
+
 	InitializeResult reply;
 	reply.capabilities = capabilities;
 	reply.serverInfo = InitializeResult_serverInfo{"Diplomat-LSP",DIPLOMAT_VERSION_STRING};
@@ -254,7 +318,7 @@ void DiplomatLSP::_h_initialized(json params)
 	&& _client_capabilities.workspace.value().didChangeConfiguration.value().dynamicRegistration.value())
 	{
 		slsp::types::Registration didChangeRegistration;
-		didChangeRegistration.id = uuids::to_string(_uuid());
+		didChangeRegistration.id = _new_uuid();
 		didChangeRegistration.method = "workspace/didChangeConfiguration";
 		p.registrations.push_back(didChangeRegistration);
 	}
@@ -297,13 +361,14 @@ json DiplomatLSP::_h_shutdown(json params)
 
 json DiplomatLSP::_h_gotoDefinition(slsp::types::DefinitionParams params)
 {
-	if (!_assert_index())
+	std::shared_ptr<di::IndexCore> index = _get_index();
+	if (!_assert_index(index.get()))
 		return {};
 	
 	slsp::types::Location result;
 
 	const di::IndexLocation lu_location = _lsp_to_index_location(params);
-	const di::IndexSymbol* lu_symb = _index->get_symbol_by_position(lu_location);
+	const di::IndexSymbol* lu_symb = index->get_symbol_by_position(lu_location);
 
 	if(lu_symb)
 	{
@@ -337,22 +402,85 @@ json DiplomatLSP::_h_gotoDefinition(slsp::types::DefinitionParams params)
 }
 
 
-json DiplomatLSP::_h_references(json _)
+/**
+ * @brief Pull the diagnostics of a document (LSP 3.17).
+ * Diagnostics are the ones of the last compilation.
+ * 
+ * @param params DocumentDiagnosticParams
+ * @return json Document diagnostic report, `unchanged` if the previous result ID is still valid.
+ */
+json DiplomatLSP::_h_document_diagnostic(json params)
+{
+	std::optional<std::string> previous_id;
+	if(params.contains("previousResultId") && params.at("previousResultId").is_string())
+		previous_id = params.at("previousResultId").template get<std::string>();
+
+	const std::string client_uri = params.at("textDocument").at("uri").template get<std::string>();
+	return _diagnostic_report(_diagnostic_uri(client_uri), previous_id);
+}
+
+/**
+ * @brief Pull the diagnostics of the whole workspace (LSP 3.17).
+ * Only the documents with diagnostics are reported, along with the documents
+ * previously reported to the client, so that their diagnostics are cleared.
+ * 
+ * @param params WorkspaceDiagnosticParams
+ * @return json Workspace diagnostic report.
+ */
+json DiplomatLSP::_h_workspace_diagnostic(json params)
 {
+	// Document key => client URI, previous result ID
+	std::unordered_map<std::string, std::pair<std::string, std::string>> previous;
+	for(const json& prev : params.at("previousResultIds"))
+	{
+		const std::string client_uri = prev.at("uri").template get<std::string>();
+		previous[_diagnostic_uri(client_uri)] = {client_uri, prev.at("value").template get<std::string>()};
+	}
+
+	json items = json::array();
+	auto add_report = [this, &items](const std::string& key, const std::string& doc_uri, const std::optional<std::string>& previous_id) {
+		json report = _diagnostic_report(key, previous_id);
+		report["uri"] = doc_uri;
+		report["version"] = nullptr;
+		items.push_back(std::move(report));
+	};
+
+	for(const auto& [key, hash] : _published_diag_hashes)
+	{
+		_throw_if_cancelled();
+		auto prev = previous.find(key);
+		if(prev == previous.end())
+			add_report(key, key, std::nullopt);
+		else
+		{
+			add_report(key, key, prev->second.second);
+			previous.erase(prev);
+		}
+	}
+
+	for(const auto& [key, prev] : previous)
+		add_report(key, prev.first, prev.second);
 
-	if (!_assert_index())
+	return json{{"items", items}};
+}
+
+json DiplomatLSP::_h_references(json _)
+{
+	std::shared_ptr<di::IndexCore> index = _get_index();
+	if (!_assert_index(index.get()))
 		return {};
 	
 	slsp::types::ReferenceParams params = _;
 
 	const di::IndexLocation lu_location = _lsp_to_index_location(params);
-	const di::IndexSymbol* lu_symb = _index->get_symbol_by_position(lu_location);
+	const di::IndexSymbol* lu_symb = index->get_symbol_by_position(lu_location);
 
 	if(lu_symb)
 	{
 		std::vector<Location> result;
 		for(const auto& range : lu_symb->get_references())
 		{
+			_throw_if_cancelled();
 			result.push_back(_index_range_to_lsp(range));
 		}
 
@@ -399,13 +527,14 @@ json DiplomatLSP::_h_references(json _)
 json DiplomatLSP::_h_rename(json _)
 {
 
-		_assert_index(true);
+		std::shared_ptr<di::IndexCore> index = _get_index();
+		_assert_index(index.get(),true);
 		
 		slsp::types::RenameParams params = _;
 		slsp::types::WorkspaceEdit result;
 
 		const di::IndexLocation lu_location = _lsp_to_index_location(params);
-		const di::IndexSymbol* lu_symb = _index->get_symbol_by_position(lu_location);
+		const di::IndexSymbol* lu_symb = index->get_symbol_by_position(lu_location);
 
 		if(lu_symb)
 		{
@@ -415,6 +544,7 @@ json DiplomatLSP::_h_rename(json _)
 
 			for(const auto& range : lu_symb->get_references())
 			{
+				_throw_if_cancelled();
 				slsp::types::Location edit_location = _index_range_to_lsp(range);
 				
 				if (! edits.contains(edit_location.uri))
@@ -522,7 +652,7 @@ void DiplomatLSP::_h_set_project(DiplomatProject params)
 	if (params.topLevel && params.topLevel->moduleName)
 		set_top_level(params.topLevel->moduleName.value());
 	else
-		_compile();
+		_request_compile();
 }
 
 
@@ -537,9 +667,10 @@ void DiplomatLSP::_h_push_config(slsp::DiplomatLSPWorkspaceSettings params)
 	log(slsp::types::MessageType::MessageType_Info,"Received configuration from client");
 	spdlog::debug("Config is {}",json(params).dump(1));
 	_settings = params;
+	_ws_scan_valid = false;
 
 	show_message(slsp::types::MessageType::MessageType_Info,"Configuration successfully loaded by the server.");
-	_compile();
+	_request_compile();
 
 }
 
@@ -585,7 +716,7 @@ const std::vector< const ModuleBlackBox*>  DiplomatLSP::_h_get_file_bb(std::stri
 
 std::vector<slsp::types::HDLModule> DiplomatLSP::_h_get_modules(json _)
 {
-	_read_workspace_modules();
+	_sync_workspace_modules();
 	std::vector<slsp::types::HDLModule> ret;
 
 	for (const auto& [path, bb_list] : _cache.get_modules())
@@ -637,7 +768,7 @@ void DiplomatLSP::_h_set_top_module(std::optional<std::string> params)
 	_settings.top_level = params;
 	spdlog::info("Set top module {}", _settings.top_level.value_or("UNDEFINED"));
 	_compute_project_tree();
-	_compile();
+	_request_compile();
 }
 
 
@@ -651,7 +782,7 @@ void DiplomatLSP::_h_set_top_module(std::optional<std::string> params)
  */
 std::vector<std::string> DiplomatLSP::_h_project_tree_from_module(HDLModule requested_root_module)
 {
-	_read_workspace_modules();
+	_sync_workspace_modules();
 	uri target_uri(requested_root_module.file);
 	
 	const ModuleBlackBox* target = nullptr;
@@ -695,6 +826,7 @@ std::vector<std::string> DiplomatLSP::_h_project_tree_from_module(HDLModule requ
 
 	while(! to_process.empty())
 	{
+		_throw_if_cancelled();
 		const std::string processed_bbname = to_process.extract(to_process.begin()).value();
 		if (processed.contains(processed_bbname))
 			continue;
@@ -726,6 +858,7 @@ void DiplomatLSP::_h_ignore(std::vector<std::string> params)
 		spdlog::info("Ignore path {}", p.generic_string());
 		_settings.excluded_paths.insert(p);
 		_project_file_tree_valid = false;
+		_ws_scan_valid = false;
 	}
 }
 
@@ -749,10 +882,12 @@ void DiplomatLSP::_h_add_to_include(json params)
 void DiplomatLSP::_h_force_clear_index(json _)
 {
 	_project_file_tree_valid = false;
-	_compilation.reset();
+	_design_hierarchy = json();
 	_broken_index_emitted = true;
-	_read_workspace_modules();
-	_compile();
+	_ws_scan_valid = false;
+	_reset_tree_cache = true;
+	_sync_workspace_modules();
+	_request_compile();
 }
 
 /**
@@ -766,15 +901,15 @@ std::map<std::string,std::optional<Location>> DiplomatLSP::_h_resolve_hier_path(
 {
 	// Params will be a list of hier paths to resolve.
 	std::map<std::string,std::optional<Location>> ret;
-	if(! _assert_index())
+	std::shared_ptr<di::IndexCore> index = _get_index();
+	if(! _assert_index(index.get()))
 		return ret;
 	
-	const auto& design_root = _compilation->getRoot();
 	for (const std::string& path: params)
 	{
 		spdlog::debug("Resolve path {}",path);
 
-		di::IndexSymbol* lu_result = _index->get_root_scope()->resolve_symbol(path);
+		di::IndexSymbol* lu_result = index->get_root_scope()->resolve_symbol(path);
 
 		if(! lu_result)
 		{
@@ -791,7 +926,8 @@ std::map<std::string,std::optional<Location>> DiplomatLSP::_h_resolve_hier_path(
 }
 
 /**
- * @brief Return a JSON view of the design hierarchy
+ * @brief Return a JSON view of the design hierarchy, 
+ * as captured by the last compilation.
  * 
  * @param _ 
  * @return json 
@@ -800,21 +936,10 @@ std::map<std::string,std::optional<Location>> DiplomatLSP::_h_resolve_hier_path(
  */
 json DiplomatLSP::_h_get_design_hierarchy(json _)
 {
-	json ret;
-
-	if(! _assert_index())
-	{
-		return ret;
-	}
-
-	const slang::ast::RootSymbol& design_root = _compilation->getRoot();
-	
-	HierVisitor hier_visitor(false,&_cache);
-
-	design_root.visit(hier_visitor);
-
-	return hier_visitor.get_hierarchy();
+	if(! _assert_index(_get_index().get()))
+		return json();
 
+	return _design_hierarchy;
 }
 
 void DiplomatLSP::_h_get_configuration(json &clientinfo)
@@ -828,6 +953,7 @@ void DiplomatLSP::_h_get_configuration(json &clientinfo)
 		_accepted_extensions.emplace(ext);
 		spdlog::debug("Add accepted extension {}",ext);
 	}   
+	_ws_scan_valid = false;
 }
 
 void DiplomatLSP::_h_get_configuration_on_init(json &clientinfo)
@@ -860,15 +986,18 @@ void DiplomatLSP::_h_update_configuration(json &params)
 std::map<std::string,std::vector<slsp::types::Range>> DiplomatLSP::_h_list_symbols(std::string path)
 {
 	std::map<std::string,std::vector<slsp::types::Range>> ret;
+	std::shared_ptr<di::IndexCore> index = _get_index();
+	if(! _assert_index(index.get()))
+		return ret;
 	
-	const di::IndexScope* lu_scope = _index->lookup_scope(path);
+	const di::IndexScope* lu_scope = index->lookup_scope(path);
 	
 	if(! lu_scope)
 	{
 		spdlog::warn("Unable to list symbols for scope {}: Scope not found.",path);
 		return ret;
 	}
-	const di::IndexFile* lu_file = _index->get_file(lu_scope->get_source_range().value_or(di::IndexRange()).start.file);// _index->get_file(path);
+	const di::IndexFile* lu_file = index->get_file_by_id(lu_scope->get_source_range().value_or(di::IndexRange()).start.file_id);// _index->get_file(path);
 
 	if(! lu_file)
 	{
@@ -876,19 +1005,22 @@ std::map<std::string,std::vector<slsp::types::Range>> DiplomatLSP::_h_list_symbo
 		return ret;
 	}
 
-	const std::map<di::IndexLocation, di::ReferenceRecord>& refs = lu_file->get_references();
+	const std::vector<di::ReferenceRecord>& refs = lu_file->get_references();
 
 	for(const auto& symbol : lu_file->get_symbols())
 	{
-		ret[symbol->get_name()] = {};
+		_throw_if_cancelled();
+		ret[std::string(symbol->get_name())] = {};
 		//const auto& def_location = symbol->get_source();
 	}
 
-	for(const auto& [loc, refrec] : refs)
+	for(const di::ReferenceRecord& refrec : refs)
 	{
-		di::IndexRange ref_range(loc, refrec.key->get_name().size());
-		if(ret.contains(refrec.key->get_name()))
-			ret.at(refrec.key->get_name()).push_back(_index_range_to_lsp(ref_range).range);
+		_throw_if_cancelled();
+		di::IndexRange ref_range(refrec.loc.start, refrec.key->get_name().size());
+		auto found = ret.find(std::string(refrec.key->get_name()));
+		if(found != ret.end())
+			found->second.push_back(_index_range_to_lsp(ref_range).range);
 	}
 
 	// spdlog::debug("{}",json(ret).dump(4));
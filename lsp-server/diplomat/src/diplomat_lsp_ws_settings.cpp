@@ -74,7 +74,12 @@ namespace slsp
             {"excludedPaths", s.excluded_paths},
             {"excludedPatterns", s.excluded_patterns},
             {"excludedDiags", s.ignored_diagnostics},
-            {"topLevel", s.top_level}};
+            {"topLevel", s.top_level},
+            {"parseThreads", s.parse_threads},
+            {"analysisThreads", s.analysis_threads},
+            {"deferAnalysis", s.defer_analysis},
+            {"compileInSubprocess", s.compile_in_subprocess},
+            {"compileMemoryLimit", s.compile_memory_limit}};
     }
     void from_json(const nlohmann::json &j, DiplomatLSPWorkspaceSettings &s)
     {
@@ -84,6 +89,11 @@ namespace slsp
         JSON_TO_STRUCT_SAFE_BIND(j,"excludedPatterns",s.excluded_patterns);
         JSON_TO_STRUCT_SAFE_BIND(j,"excludedDiags",s.ignored_diagnostics);
         JSON_TO_STRUCT_SAFE_BIND(j,"topLevel",s.top_level);
+        JSON_TO_STRUCT_SAFE_BIND(j,"parseThreads",s.parse_threads);
+        JSON_TO_STRUCT_SAFE_BIND(j,"analysisThreads",s.analysis_threads);
+        JSON_TO_STRUCT_SAFE_BIND(j,"deferAnalysis",s.defer_analysis);
+        JSON_TO_STRUCT_SAFE_BIND(j,"compileInSubprocess",s.compile_in_subprocess);
+        JSON_TO_STRUCT_SAFE_BIND(j,"compileMemoryLimit",s.compile_memory_limit);
 
         s.refresh_regexs();
     }
@@ -96,4 +106,18 @@ namespace slsp
             excluded_regexs.push_back(std::regex(pat));
         }
     }
+
+    bool DiplomatLSPWorkspaceSettings::is_excluded(const std::string& path) const
+    {
+        // Check for explicitely excluded paths (fast)
+        if (excluded_paths.contains(path))
+            return true;
+
+        for(const std::regex& rgx : excluded_regexs)
+        {
+            if (std::regex_match(path,rgx))
+                return true;
+        }
+        return false;
+    }
 }
\ No newline at end of file
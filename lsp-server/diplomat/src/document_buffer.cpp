@@ -0,0 +1,205 @@
+#include "document_buffer.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace diplomat::cache
+{
+
+//! Above this number of pieces, the document is compacted to keep the lookups fast.
+static constexpr std::size_t MAX_PIECES = 2048;
+
+static std::size_t count_newlines(std::string_view text)
+{
+	return std::count(text.begin(), text.end(), '\n');
+}
+
+//! Length of an UTF-8 sequence from its first byte. Invalid bytes count as one character.
+static std::size_t utf8_length(unsigned char c)
+{
+	if(c < 0x80)
+		return 1;
+	if((c >> 5) == 0x6)
+		return 2;
+	if((c >> 4) == 0xE)
+		return 3;
+	if((c >> 3) == 0x1E)
+		return 4;
+	return 1;
+}
+
+DocumentBuffer::DocumentBuffer(std::string content, int version) : _size(0), _version(version)
+{
+	replace(std::move(content), version);
+}
+
+void DocumentBuffer::replace(std::string content, int version)
+{
+	_original = std::move(content);
+	_added.clear();
+	_pieces.clear();
+	_size = _original.size();
+	_version = version;
+	if(_size > 0)
+		_pieces.push_back(Piece{false, 0, _size, count_newlines(_original)});
+}
+
+void DocumentBuffer::apply_change(unsigned int start_line, unsigned int start_char,
+	unsigned int end_line, unsigned int end_char, std::string_view text, int version)
+{
+	std::size_t start = _offset_of(start_line, start_char);
+	std::size_t end = _offset_of(end_line, end_char);
+	if(end < start)
+		std::swap(start, end);
+
+	_erase(start, end - start);
+	_insert(start, text);
+	_version = version;
+
+	if(_pieces.size() > MAX_PIECES)
+		_compact();
+}
+
+std::string DocumentBuffer::text() const
+{
+	std::string ret;
+	ret.reserve(_size);
+	for(const Piece& piece : _pieces)
+		ret.append(_view(piece));
+	return ret;
+}
+
+std::string_view DocumentBuffer::_view(const Piece& piece) const
+{
+	return std::string_view(piece.added ? _added : _original).substr(piece.start, piece.length);
+}
+
+/**
+ * Lines are located using the line feed count of each piece, so that only
+ * the pieces holding the targeted line are actually scanned.
+ */
+std::size_t DocumentBuffer::_offset_of(unsigned int line, unsigned int character) const
+{
+	std::size_t idx = 0;
+	std::size_t piece_start = 0;
+	std::size_t in_piece = 0;
+
+	unsigned int curr_line = 0;
+	while(curr_line < line)
+	{
+		if(idx == _pieces.size())
+			return _size;
+
+		const Piece& piece = _pieces[idx];
+		if(curr_line + piece.newlines < line)
+		{
+			curr_line += piece.newlines;
+			piece_start += piece.length;
+			idx++;
+			continue;
+		}
+
+		std::string_view content = _view(piece);
+		while(curr_line < line)
+		{
+			in_piece = content.find('\n', in_piece) + 1;
+			curr_line++;
+		}
+	}
+
+	// Columns, in UTF-16 code units, up to the end of the line.
+	unsigned int units = 0;
+	while(idx < _pieces.size() && units < character)
+	{
+		std::string_view content = _view(_pieces[idx]);
+		while(in_piece < content.size() && units < character)
+		{
+			unsigned char c = content[in_piece];
+			if(c == '\n')
+				return piece_start + in_piece;
+
+			std::size_t len = utf8_length(c);
+			units += len == 4 ? 2 : 1;
+			in_piece += len;
+		}
+
+		if(in_piece < content.size())
+			break;
+
+		// A sequence may span over the next piece.
+		in_piece -= content.size();
+		piece_start += content.size();
+		idx++;
+	}
+
+	return std::min(piece_start + in_piece, _size);
+}
+
+std::size_t DocumentBuffer::_split(std::size_t offset)
+{
+	std::size_t piece_start = 0;
+	for(std::size_t idx = 0; idx < _pieces.size(); idx++)
+	{
+		Piece& piece = _pieces[idx];
+		if(piece_start == offset)
+			return idx;
+
+		if(offset < piece_start + piece.length)
+		{
+			const std::size_t head_length = offset - piece_start;
+			const std::size_t head_newlines = count_newlines(_view(piece).substr(0, head_length));
+			Piece tail{piece.added, piece.start + head_length, piece.length - head_length, piece.newlines - head_newlines};
+
+			piece.length = head_length;
+			piece.newlines = head_newlines;
+			_pieces.insert(_pieces.begin() + idx + 1, tail);
+			return idx + 1;
+		}
+		piece_start += piece.length;
+	}
+	return _pieces.size();
+}
+
+void DocumentBuffer::_erase(std::size_t offset, std::size_t length)
+{
+	if(length == 0)
+		return;
+
+	const std::size_t first = _split(offset);
+	const std::size_t last = _split(offset + length);
+	_pieces.erase(_pieces.begin() + first, _pieces.begin() + last);
+	_size -= length;
+}
+
+void DocumentBuffer::_insert(std::size_t offset, std::string_view text)
+{
+	if(text.empty())
+		return;
+
+	const std::size_t idx = _split(offset);
+	const std::size_t newlines = count_newlines(text);
+	_size += text.size();
+
+	// Typing mostly appends right after the last inserted text: extend its piece.
+	if(idx > 0)
+	{
+		Piece& prev = _pieces[idx - 1];
+		if(prev.added && prev.start + prev.length == _added.size())
+		{
+			_added.append(text);
+			prev.length += text.size();
+			prev.newlines += newlines;
+			return;
+		}
+	}
+
+	_pieces.insert(_pieces.begin() + idx, Piece{true, _added.size(), text.size(), newlines});
+	_added.append(text);
+}
+
+void DocumentBuffer::_compact()
+{
+	replace(text(), _version);
+}
+
+}
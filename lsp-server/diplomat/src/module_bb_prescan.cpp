@@ -0,0 +1,513 @@
+#include "module_bb_prescan.hpp"
+
+#include "slang/diagnostics/Diagnostics.h"
+#include "slang/parsing/Preprocessor.h"
+#include "slang/parsing/Token.h"
+#include "slang/syntax/SyntaxTree.h"
+#include "slang/util/BumpAllocator.h"
+
+#include <spdlog/spdlog.h>
+
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+using slang::parsing::Token;
+using slang::parsing::TokenKind;
+using slang::parsing::TriviaKind;
+
+using bb_map_t = std::unordered_map<std::string,std::unique_ptr<ModuleBlackBox>>;
+
+namespace
+{
+	struct DeclarationEnd
+	{
+		TokenKind kind;
+		std::string_view text;
+	};
+
+	/**
+	 * @brief Get the closing keyword of a declaration parsed as a `ModuleDeclarationSyntax`.
+	 */
+	std::optional<DeclarationEnd> declaration_end(TokenKind kind)
+	{
+		switch (kind)
+		{
+		case TokenKind::ModuleKeyword:
+		case TokenKind::MacromoduleKeyword:
+			return DeclarationEnd{TokenKind::EndModuleKeyword, "endmodule"};
+		case TokenKind::InterfaceKeyword:
+			return DeclarationEnd{TokenKind::EndInterfaceKeyword, "endinterface"};
+		case TokenKind::ProgramKeyword:
+			return DeclarationEnd{TokenKind::EndProgramKeyword, "endprogram"};
+		case TokenKind::PackageKeyword:
+			return DeclarationEnd{TokenKind::EndPackageKeyword, "endpackage"};
+		default:
+			return {};
+		}
+	}
+
+	#ifdef DIPLOMAT_DEBUG
+	/**
+	 * @brief Check the prescan result against the blackboxes read from the full syntax tree.
+	 */
+	bool same_as_full_parse(slang::SourceManager& sm, const slang::SourceBuffer& buffer, const bb_map_t& prescanned)
+	{
+		auto tree = slang::syntax::SyntaxTree::fromBuffer(buffer, sm);
+		VisitorModuleBlackBox visitor;
+		tree->root().visit(visitor);
+
+		bool same = visitor.read_bb->size() == prescanned.size();
+		for(const auto& [name, bb] : *visitor.read_bb)
+		{
+			auto found = prescanned.find(name);
+			if(found == prescanned.end() || found->second->deps != bb->deps)
+			{
+				spdlog::error("Prescan of {} differs from the full parse for module {}", sm.getFullPath(buffer.id).generic_string(), name);
+				same = false;
+			}
+		}
+		return same;
+	}
+	#endif
+
+	/**
+	 * @brief Token-level scanner of a file, see prescan_module_blackboxes()
+	 */
+	class ModuleBlackBoxPrescanner
+	{
+		protected:
+			slang::SourceManager& _sm;
+			const slang::SourceBuffer& _buffer;
+			std::span<const Token> _tokens;
+			std::size_t _pos;
+
+			//! Position right after the last `begin` or `end...` keyword and its label,
+			//! which starts a module item whatever the previous token is.
+			std::size_t _item_start;
+
+			//! Tokens past the end all map to the final EndOfFile token.
+			const Token& _peek(std::size_t ahead = 0) const
+			{
+				return _tokens[std::min(_pos + ahead, _tokens.size() - 1)];
+			}
+
+			const Token& _prev() const
+			{
+				return _tokens[_pos - 1];
+			}
+
+			/**
+			 * @brief Check that a token comes straight from the scanned buffer and has
+			 * no directive around it, such that the header text may be parsed on its own.
+			 */
+			bool _is_plain(const Token& tok) const
+			{
+				if(tok.location().buffer() != _buffer.id)
+					return false;
+
+				for(const slang::parsing::Trivia& t : tok.trivia())
+				{
+					if(t.kind != TriviaKind::Whitespace && t.kind != TriviaKind::EndOfLine
+						&& t.kind != TriviaKind::LineComment && t.kind != TriviaKind::BlockComment)
+						return false;
+				}
+				return true;
+			}
+
+			/**
+			 * @brief Get the index right after the group starting at \p idx
+			 * (that shall be an opening token), or nothing if the file ends before.
+			 */
+			std::optional<std::size_t> _group_end(std::size_t idx) const
+			{
+				int depth = 0;
+				for(std::size_t i = idx; i < _tokens.size(); i++)
+				{
+					switch (_tokens[i].kind)
+					{
+					case TokenKind::OpenParenthesis:
+					case TokenKind::OpenBracket:
+					case TokenKind::OpenBrace:
+						depth++;
+						break;
+					case TokenKind::CloseParenthesis:
+					case TokenKind::CloseBracket:
+					case TokenKind::CloseBrace:
+						if(--depth == 0)
+							return i + 1;
+						break;
+					case TokenKind::EndOfFile:
+						return {};
+					default:
+						break;
+					}
+				}
+				return {};
+			}
+
+			bool _skip_past(TokenKind kind)
+			{
+				for(; _peek().kind != TokenKind::EndOfFile; _pos++)
+				{
+					if(_peek().kind == kind)
+					{
+						_pos++;
+						return true;
+					}
+				}
+				return false;
+			}
+
+			/**
+			 * @brief Skip a whole declaration (function, class...), up to its closing keyword.
+			 * Fails on parameters, which would be reported by the visitor.
+			 */
+			bool _skip_declaration(TokenKind open, TokenKind close)
+			{
+				int depth = 0;
+				for(; _peek().kind != TokenKind::EndOfFile; _pos++)
+				{
+					const TokenKind kind = _peek().kind;
+					if(kind == TokenKind::ParameterKeyword)
+						return false;
+					else if(kind == open)
+						depth++;
+					else if(kind == close && --depth == 0)
+					{
+						_pos++;
+						_skip_label();
+						return true;
+					}
+				}
+				return false;
+			}
+
+			/**
+			 * @brief Skip the `: label` following `begin` or any `end...` keyword.
+			 * The next token starts a module item, whether there is a label or not.
+			 */
+			void _skip_label()
+			{
+				if(_peek().kind == TokenKind::Colon && _peek(1).kind == TokenKind::Identifier)
+					_pos += 2;
+				_item_start = _pos;
+			}
+
+			static bool _is_end_keyword(const Token& tok)
+			{
+				return tok.kind != TokenKind::Identifier && tok.rawText().starts_with("end");
+			}
+
+			/**
+			 * @brief Check if the current token starts a new module item.
+			 */
+			bool _at_item_start() const
+			{
+				if(_pos == _item_start)
+					return true;
+
+				switch (_prev().kind)
+				{
+				case TokenKind::Semicolon:
+				case TokenKind::Colon:
+				case TokenKind::CloseParenthesis:
+				case TokenKind::StarCloseParenthesis:
+				case TokenKind::ElseKeyword:
+				case TokenKind::GenerateKeyword:
+					return true;
+				default:
+					return false;
+				}
+			}
+
+			/**
+			 * @brief Parse the header starting at the current token (the declaration keyword)
+			 * and extract its blackbox, without any dependency.
+			 */
+			std::unique_ptr<ModuleBlackBox> _parse_header(std::string_view end_text)
+			{
+				const Token& first = _peek();
+				if(! _is_plain(first))
+					return nullptr;
+
+				int depth = 0;
+				bool in_import = false;
+				for(_pos++; ; _pos++)
+				{
+					const Token& tok = _peek();
+					if(tok.kind == TokenKind::EndOfFile || ! _is_plain(tok))
+						return nullptr;
+
+					switch (tok.kind)
+					{
+					case TokenKind::OpenParenthesis:
+					case TokenKind::OpenBracket:
+					case TokenKind::OpenBrace:
+						depth++;
+						break;
+					case TokenKind::CloseParenthesis:
+					case TokenKind::CloseBracket:
+					case TokenKind::CloseBrace:
+						depth--;
+						break;
+					case TokenKind::ImportKeyword:
+						in_import = depth == 0;
+						break;
+					default:
+						break;
+					}
+
+					// Package imports placed in the header have their own semicolon.
+					if(tok.kind == TokenKind::Semicolon && depth == 0)
+					{
+						if(! in_import)
+							break;
+						in_import = false;
+					}
+				}
+
+				const std::size_t start = first.location().offset();
+				const std::size_t end = _peek().location().offset() + _peek().rawText().length();
+				_pos++;
+
+				std::string text(_buffer.data.substr(start, end - start));
+				text += "\n";
+				text += end_text;
+				text += "\n";
+
+				auto tree = slang::syntax::SyntaxTree::fromText(text, _sm, "prescan");
+				if(! tree->diagnostics().empty())
+					return nullptr;
+
+				VisitorModuleBlackBox visitor;
+				tree->root().visit(visitor);
+				if(visitor.read_bb->size() != 1)
+					return nullptr;
+
+				return std::move(visitor.read_bb->begin()->second);
+			}
+
+			/**
+			 * @brief Handle an identifier starting a module item, recording it as a dependency
+			 * if it is an instantiation.
+			 *
+			 * @return false if it can't be decided without the parser.
+			 */
+			bool _scan_instantiation(ModuleBlackBox& bb)
+			{
+				const Token& type = _peek();
+				std::size_t idx = 1;
+				bool parameterized = false;
+
+				if(_peek(idx).kind == TokenKind::Hash)
+				{
+					parameterized = true;
+					idx++;
+					if(_peek(idx).kind == TokenKind::OpenParenthesis)
+					{
+						std::optional<std::size_t> after = _group_end(_pos + idx);
+						if(! after)
+							return false;
+						idx = after.value() - _pos;
+					}
+					else
+						idx++;
+
+					// Parameterized class scope, such as `cls#(T)::type_t`
+					if(_peek(idx).kind == TokenKind::DoubleColon)
+					{
+						_pos += idx;
+						return true;
+					}
+					else if(_peek(idx).kind != TokenKind::Identifier)
+						return false;
+				}
+				else if(_peek(idx).kind == TokenKind::OpenParenthesis)
+				{
+					// Either a task call or an unnamed instance, depending on the context.
+					return false;
+				}
+				else if(_peek(idx).kind != TokenKind::Identifier)
+				{
+					_pos++;
+					return true;
+				}
+
+				// Instance name, with optional instance array dimensions
+				idx++;
+				while(_peek(idx).kind == TokenKind::OpenBracket)
+				{
+					std::optional<std::size_t> after = _group_end(_pos + idx);
+					if(! after)
+						return false;
+					idx = after.value() - _pos;
+				}
+
+				if(_peek(idx).kind != TokenKind::OpenParenthesis)
+				{
+					// Data declaration using a user-defined type.
+					if(parameterized)
+						return false;
+					_pos++;
+					return true;
+				}
+
+				bb.deps.insert(std::string(type.rawText()));
+				_pos += idx;
+				return true;
+			}
+
+			/**
+			 * @brief Scan a declaration body up to its closing keyword, collecting dependencies.
+			 */
+			bool _scan_body(TokenKind end_kind, ModuleBlackBox& bb)
+			{
+				while(true)
+				{
+					const Token& tok = _peek();
+					switch (tok.kind)
+					{
+					case TokenKind::EndOfFile:
+					// Parameters declared in the body are part of the blackbox,
+					// and other constructs hold instantiations that are hard to track.
+					case TokenKind::ParameterKeyword:
+					case TokenKind::ModuleKeyword:
+					case TokenKind::MacromoduleKeyword:
+					case TokenKind::InterfaceKeyword:
+					case TokenKind::ProgramKeyword:
+					case TokenKind::PackageKeyword:
+					case TokenKind::ExternKeyword:
+					case TokenKind::PureKeyword:
+					case TokenKind::BindKeyword:
+					case TokenKind::CheckerKeyword:
+					case TokenKind::ConfigKeyword:
+					case TokenKind::PrimitiveKeyword:
+						return false;
+
+					case TokenKind::ImportKeyword:
+					case TokenKind::ExportKeyword:
+						if(! _skip_past(TokenKind::Semicolon))
+							return false;
+						break;
+
+					// Declarations that can't contain any instantiation,
+					// but may contain anything looking like one.
+					case TokenKind::FunctionKeyword:
+						if(! _skip_declaration(TokenKind::FunctionKeyword, TokenKind::EndFunctionKeyword))
+							return false;
+						break;
+					case TokenKind::TaskKeyword:
+						if(! _skip_declaration(TokenKind::TaskKeyword, TokenKind::EndTaskKeyword))
+							return false;
+						break;
+					case TokenKind::CoverGroupKeyword:
+						if(! _skip_declaration(TokenKind::CoverGroupKeyword, TokenKind::EndGroupKeyword))
+							return false;
+						break;
+					case TokenKind::SpecifyKeyword:
+						if(! _skip_declaration(TokenKind::SpecifyKeyword, TokenKind::EndSpecifyKeyword))
+							return false;
+						break;
+					case TokenKind::ClassKeyword:
+						// Forward declarations have no body
+						if(_prev().kind == TokenKind::TypedefKeyword)
+							_pos++;
+						else if(! _skip_declaration(TokenKind::ClassKeyword, TokenKind::EndClassKeyword))
+							return false;
+						break;
+					case TokenKind::PropertyKeyword:
+					case TokenKind::SequenceKeyword:
+						// Declarations only, not `assert property` and such.
+						if(! _at_item_start())
+							_pos++;
+						else if(! _skip_declaration(tok.kind, tok.kind == TokenKind::PropertyKeyword ?
+							TokenKind::EndPropertyKeyword : TokenKind::EndSequenceKeyword))
+							return false;
+						break;
+
+					case TokenKind::Identifier:
+						if(! _at_item_start())
+							_pos++;
+						else if(! _scan_instantiation(bb))
+							return false;
+						break;
+
+					default:
+						_pos++;
+						if(tok.kind == end_kind)
+						{
+							_skip_label();
+							return true;
+						}
+						else if(tok.kind == TokenKind::BeginKeyword || _is_end_keyword(tok))
+							_skip_label();
+						break;
+					}
+				}
+			}
+
+		public:
+			ModuleBlackBoxPrescanner(slang::SourceManager& sm, const slang::SourceBuffer& buffer, std::span<const Token> tokens) :
+				_sm(sm), _buffer(buffer), _tokens(tokens), _pos(0), _item_start(0)
+			{}
+
+			std::unique_ptr<bb_map_t> run()
+			{
+				std::unique_ptr<bb_map_t> result(new bb_map_t());
+				while(_peek().kind != TokenKind::EndOfFile)
+				{
+					const Token& tok = _peek();
+					if(std::optional<DeclarationEnd> end = declaration_end(tok.kind))
+					{
+						std::unique_ptr<ModuleBlackBox> bb = _parse_header(end->text);
+						if(! bb || ! _scan_body(end->kind, *bb))
+							return nullptr;
+
+						// Same as the visitor: the first declaration of a name is kept.
+						std::string name = bb->module_name;
+						result->emplace(name, std::move(bb));
+					}
+					else if(tok.kind == TokenKind::ImportKeyword || tok.kind == TokenKind::TimeUnitKeyword
+						|| tok.kind == TokenKind::TimePrecisionKeyword)
+					{
+						if(! _skip_past(TokenKind::Semicolon))
+							return nullptr;
+					}
+					else if(tok.kind == TokenKind::Semicolon)
+						_pos++;
+					else
+						// Anything else in the compilation unit is left to the parser.
+						return nullptr;
+				}
+				return result;
+			}
+	};
+}
+
+std::unique_ptr<bb_map_t> prescan_module_blackboxes(slang::SourceManager& sm, const slang::SourceBuffer& buffer)
+{
+	slang::BumpAllocator alloc;
+	slang::Diagnostics diagnostics;
+	slang::parsing::Preprocessor preprocessor(sm, alloc, diagnostics);
+	preprocessor.pushSource(buffer);
+
+	std::vector<Token> tokens;
+	Token tok;
+	do
+	{
+		tok = preprocessor.next();
+		tokens.push_back(tok);
+	} while (tok.kind != TokenKind::EndOfFile);
+
+	ModuleBlackBoxPrescanner scanner(sm, buffer, tokens);
+	std::unique_ptr<bb_map_t> result = scanner.run();
+
+	#ifdef DIPLOMAT_DEBUG
+	if(result && ! same_as_full_parse(sm, buffer, *result))
+		return nullptr;
+	#endif
+
+	return result;
+}
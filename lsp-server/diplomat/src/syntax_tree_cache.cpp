@@ -0,0 +1,328 @@
+#include "syntax_tree_cache.hpp"
+#include "diplomat_document_cache.hpp"
+
+#include "slang/diagnostics/PreprocessorDiags.h"
+#include "slang/util/ThreadPool.h"
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+
+namespace diplomat::cache
+{
+
+//! The source manager is rebuilt when it holds more outdated buffers than this
+//! or than the number of cached trees.
+static constexpr std::size_t MIN_STALE_BUFFERS = 64;
+
+//! The source manager is also rebuilt when a file has been loaded this many times,
+//! as each load adds a `/.` to its alias path.
+static constexpr unsigned int MAX_FILE_REVISIONS = 32;
+
+bool SyntaxTreeCache::_read_stamp(const std::filesystem::path& fpath, FileStamp& stamp)
+{
+	std::error_code ec;
+	stamp.size = fs::file_size(fpath, ec);
+	if(ec)
+		return false;
+	stamp.mtime = fs::last_write_time(fpath, ec);
+	return ! ec;
+}
+
+void SyntaxTreeCache::set_include_dirs(const std::vector<std::string>& include_dirs)
+{
+	std::lock_guard lock(_access);
+	_requested_include_dirs = include_dirs;
+}
+
+void SyntaxTreeCache::set_parse_threads(unsigned int threads)
+{
+	std::lock_guard lock(_access);
+	_parse_threads = threads;
+}
+
+void SyntaxTreeCache::set_overlay(const std::filesystem::path& fpath, std::string content)
+{
+	std::lock_guard lock(_access);
+	_overlays.insert_or_assign(fpath, std::move(content));
+}
+
+void SyntaxTreeCache::remove_overlay(const std::filesystem::path& fpath)
+{
+	std::lock_guard lock(_access);
+	_overlays.erase(fpath);
+}
+
+void SyntaxTreeCache::_prepare()
+{
+	bool rebuild = ! _sm;
+
+	if(! rebuild && _requested_include_dirs != _include_dirs)
+	{
+		spdlog::info("Include directories changed, all files will be parsed.");
+		rebuild = true;
+	}
+
+	if(! rebuild && _stale_buffers > std::max(MIN_STALE_BUFFERS, _trees.size()))
+	{
+		spdlog::debug("Too many outdated buffers, rebuild the syntax tree cache.");
+		rebuild = true;
+	}
+
+	if(! rebuild && _max_revision >= MAX_FILE_REVISIONS)
+	{
+		spdlog::debug("Too many aliases for a single file, rebuild the syntax tree cache.");
+		rebuild = true;
+	}
+
+	if(! rebuild)
+	{
+		for(const auto& [path, stamp] : _includes)
+		{
+			FileStamp current;
+			if(! _read_stamp(path, current) || current.size != stamp.size || current.mtime != stamp.mtime)
+			{
+				spdlog::info("Included file {} changed, all files will be parsed.", path.generic_string());
+				rebuild = true;
+				break;
+			}
+		}
+	}
+
+	if(rebuild)
+	{
+		_clear();
+		_sm = std::make_shared<slang::SourceManager>();
+		for(const std::string& dir : _requested_include_dirs)
+			_sm->addUserDirectories(dir);
+		_include_dirs = _requested_include_dirs;
+	}
+}
+
+void SyntaxTreeCache::clear()
+{
+	std::lock_guard lock(_access);
+	_clear();
+}
+
+void SyntaxTreeCache::_clear()
+{
+	// Trees first, as they refer to the source manager buffers.
+	_trees.clear();
+	_includes.clear();
+	_revisions.clear();
+	_max_revision = 0;
+	_stale_buffers = 0;
+	_last_scanned_buffer = 0;
+	_sm.reset();
+}
+
+/**
+ * The size and modification time are checked first. When they differ, the content
+ * hash is checked as well, such that a file which has only been touched is not parsed again.
+ * Overlays have no meaningful stamp, so that only their hash is checked.
+ *
+ * Files to parse are read in order, then parsed in parallel, as the source manager is 
+ * thread-safe. Each parsing job only writes to its own slot, so that the resulting trees 
+ * keep the order of \p files whatever the scheduling.
+ */
+SyntaxTreeCache::TreeSet SyntaxTreeCache::get_trees(const std::vector<std::filesystem::path>& files, bool drop_others)
+{
+	std::lock_guard lock(_access);
+	_prepare();
+
+	TreeSet result;
+	result.sm = _sm;
+	result.trees.reserve(files.size());
+	result.stamps.reserve(files.size());
+	std::unordered_set<fs::path> requested;
+	std::size_t parsed = 0;
+
+	struct ParseJob
+	{
+		std::size_t slot;
+		const fs::path* path;
+		FileStamp stamp;
+		std::string content;
+		unsigned int* revision;
+		bool replaced;
+		tree_ptr_t tree;
+	};
+	std::vector<ParseJob> jobs;
+
+	for(const fs::path& fpath : files)
+	{
+		requested.insert(fpath);
+
+		auto found = _trees.find(fpath);
+		const bool reusable = found != _trees.end() && ! found->second.always_reparse;
+
+		FileStamp stamp;
+		std::string content;
+		auto overlay = _overlays.find(fpath);
+		if(overlay != _overlays.end())
+		{
+			content = overlay->second;
+			stamp.size = content.size();
+			stamp.mtime = fs::file_time_type::min();
+		}
+		else
+		{
+			if(! _read_stamp(fpath, stamp))
+			{
+				result.trees.push_back(nullptr);
+				result.stamps.push_back(FileStamp{});
+				continue;
+			}
+
+			if(reusable && found->second.stamp.size == stamp.size && found->second.stamp.mtime == stamp.mtime)
+			{
+				result.trees.push_back(found->second.tree);
+				result.stamps.push_back(found->second.stamp);
+				continue;
+			}
+
+			std::ifstream in(fpath, std::ios::binary);
+			if(! in)
+			{
+				result.trees.push_back(nullptr);
+				result.stamps.push_back(FileStamp{});
+				continue;
+			}
+			std::ostringstream read;
+			read << in.rdbuf();
+			content = std::move(read).str();
+		}
+
+		stamp.hash = DiplomatDocumentCache::hash_content(content);
+		if(reusable && found->second.stamp.hash == stamp.hash)
+		{
+			found->second.stamp = stamp;
+			result.trees.push_back(found->second.tree);
+			result.stamps.push_back(stamp);
+			continue;
+		}
+
+		// References to map elements are stable, so that each job may update its own counter.
+		jobs.push_back(ParseJob{result.trees.size(), &fpath, stamp, std::move(content),
+			&_revisions[fpath], found != _trees.end(), nullptr});
+		result.trees.push_back(nullptr);
+		result.stamps.push_back(stamp);
+	}
+
+	if(jobs.size() > 1)
+	{
+		slang::ThreadPool pool(std::min<std::size_t>(_parse_threads ? _parse_threads : std::thread::hardware_concurrency(), jobs.size()));
+		for(ParseJob& job : jobs)
+			pool.pushTask([this, &job]() { job.tree = _parse(*job.path, job.content, *job.revision); });
+		pool.waitForAll();
+	}
+	else
+	{
+		for(ParseJob& job : jobs)
+			job.tree = _parse(*job.path, job.content, *job.revision);
+	}
+
+	for(ParseJob& job : jobs)
+	{
+		if(job.replaced)
+			_stale_buffers++;
+		_max_revision = std::max(_max_revision, *job.revision);
+
+		bool missing_include = false;
+		if(job.tree)
+		{
+			for(const slang::Diagnostic& diag : job.tree->diagnostics())
+			{
+				if(diag.code == slang::diag::CouldNotOpenIncludeFile)
+				{
+					missing_include = true;
+					break;
+				}
+			}
+			parsed++;
+		}
+
+		_trees.insert_or_assign(*job.path, TreeEntry{job.stamp, job.tree, missing_include});
+		result.trees[job.slot] = job.tree;
+	}
+
+	if(drop_others)
+	{
+		std::erase_if(_trees, [this, &requested](const auto& entry) {
+			if(requested.contains(entry.first))
+				return false;
+			_stale_buffers++;
+			return true;
+		});
+	}
+
+	_record_includes();
+
+	spdlog::info("Syntax trees: {} parsed, {} reused.", parsed, files.size() - parsed);
+	return result;
+}
+
+SyntaxTreeCache::tree_ptr_t SyntaxTreeCache::_parse(const std::filesystem::path& fpath, std::string_view content, unsigned int& revision)
+{
+	static constexpr unsigned int MAX_ALIAS_ATTEMPTS = 16;
+
+	const std::string dir = fpath.parent_path().generic_string();
+	const std::string fname = fpath.filename().generic_string();
+
+	for(unsigned int attempt = 0; attempt < MAX_ALIAS_ATTEMPTS; attempt++)
+	{
+		std::string alias = dir;
+		for(unsigned int i = 0; i < revision; i++)
+			alias += "/.";
+		alias += "/" + fname;
+		revision++;
+
+		try
+		{
+			slang::SourceBuffer buffer = _sm->assignText(alias, content);
+			return slang::syntax::SyntaxTree::fromBuffer(buffer, *_sm);
+		}
+		catch(const std::runtime_error& e)
+		{
+			// The path is already known by the source manager,
+			// because the file has been included for example.
+			spdlog::debug("Unable to load {} as {}: {}", fpath.generic_string(), alias, e.what());
+		}
+	}
+
+	spdlog::error("Unable to load {} in the source manager.", fpath.generic_string());
+	return nullptr;
+}
+
+void SyntaxTreeCache::_record_includes()
+{
+	std::uint32_t last_id = _last_scanned_buffer;
+	for(const slang::BufferID id : _sm->getAllBuffers())
+	{
+		if(id.getId() <= _last_scanned_buffer)
+			continue;
+		last_id = std::max(last_id, id.getId());
+
+		if(! _sm->getIncludedFrom(id).valid())
+			continue;
+
+		std::error_code ec;
+		fs::path included = fs::weakly_canonical(_sm->getFullPath(id), ec);
+		if(ec || _includes.contains(included))
+			continue;
+
+		FileStamp stamp{};
+		if(_read_stamp(included, stamp))
+			_includes.emplace(included, stamp);
+	}
+	_last_scanned_buffer = last_id;
+}
+
+}
@@ -71,6 +71,8 @@ void from_json(const json& j, ModuleBlackBox& p)
 	j.at("module").get_to(p.module_name);
 	j.at("parameters").get_to(p.parameters);
 	j.at("ports").get_to(p.ports);
+	if(j.contains("dependencies"))
+		j.at("dependencies").get_to(p.deps);
 }
 
 VisitorModuleBlackBox::VisitorModuleBlackBox(bool only_modules, const slang::SourceManager* sm) : 
@@ -0,0 +1,247 @@
+#include "workspace_watcher.hpp"
+
+#include "spdlog/spdlog.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace fs = std::filesystem;
+
+using namespace diplomat::cache;
+
+#ifdef __linux__
+//! Events of interest on watched directories.
+static constexpr uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+	| IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+#endif
+
+WorkspaceWatcher::~WorkspaceWatcher()
+{
+	stop();
+}
+
+bool WorkspaceWatcher::start(const std::unordered_set<std::filesystem::path>& roots, exclusion_filter_t is_excluded)
+{
+	stop();
+
+#ifdef __linux__
+	_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(_fd < 0)
+	{
+		spdlog::warn("Unable to initialize the workspace watcher: {}", std::strerror(errno));
+		return false;
+	}
+
+	_is_excluded = std::move(is_excluded);
+
+	for(const fs::path& root : roots)
+	{
+		if(! _watch_tree(root, false))
+		{
+			spdlog::warn("Unable to watch the whole workspace, falling back to full workspace scans.");
+			stop();
+			return false;
+		}
+	}
+
+	spdlog::info("Watching {} workspace directories", _watched_dirs.size());
+	_watch_thread = std::jthread(std::bind_front(&WorkspaceWatcher::_watch_loop, this));
+	return true;
+#else
+	return false;
+#endif
+}
+
+void WorkspaceWatcher::stop()
+{
+	if(_watch_thread.joinable())
+	{
+		_watch_thread.request_stop();
+		_watch_thread.join();
+	}
+
+#ifdef __linux__
+	if(_fd >= 0)
+		close(_fd);
+#endif
+
+	_fd = -1;
+	_watched_dirs.clear();
+
+	std::lock_guard lock(_events_access);
+	_events.clear();
+}
+
+std::vector<WorkspaceWatcher::Event> WorkspaceWatcher::take_events()
+{
+	std::vector<Event> ret;
+	std::lock_guard lock(_events_access);
+	ret.swap(_events);
+	return ret;
+}
+
+void WorkspaceWatcher::_push_event(EventKind kind, const std::filesystem::path& path)
+{
+	std::lock_guard lock(_events_access);
+	_events.push_back(Event{kind, path});
+}
+
+bool WorkspaceWatcher::_watch_tree(const std::filesystem::path& dir, bool report_files)
+{
+#ifdef __linux__
+	std::error_code ec;
+	if(_is_excluded(dir) || ! fs::is_directory(dir, ec))
+		return true;
+
+	auto add_watch = [this](const fs::path& p) -> bool {
+		int wd = inotify_add_watch(_fd, p.c_str(), WATCH_MASK);
+		if(wd < 0)
+		{
+			// The directory may have been removed in between, which is not an issue.
+			if(errno == ENOENT || errno == ENOTDIR)
+				return true;
+			spdlog::warn("Unable to watch {}: {}", p.generic_string(), std::strerror(errno));
+			return false;
+		}
+		_watched_dirs[wd] = p;
+		return true;
+	};
+
+	if(! add_watch(dir))
+		return false;
+
+	fs::recursive_directory_iterator it(dir, fs::directory_options::skip_permission_denied, ec);
+	for(; ! ec && it != fs::recursive_directory_iterator(); it.increment(ec))
+	{
+		const fs::directory_entry& entry = *it;
+		if(_is_excluded(entry.path()))
+		{
+			if(entry.is_directory(ec))
+				it.disable_recursion_pending();
+			continue;
+		}
+
+		if(entry.is_directory(ec))
+		{
+			if(! add_watch(entry.path()))
+				return false;
+		}
+		else if(report_files && entry.is_regular_file(ec))
+			_push_event(EventKind::Changed, entry.path());
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+void WorkspaceWatcher::_unwatch_tree(const std::filesystem::path& dir)
+{
+#ifdef __linux__
+	const std::string prefix = dir.generic_string() + "/";
+	for(auto it = _watched_dirs.begin(); it != _watched_dirs.end();)
+	{
+		if(it->second == dir || it->second.generic_string().starts_with(prefix))
+		{
+			inotify_rm_watch(_fd, it->first);
+			it = _watched_dirs.erase(it);
+		}
+		else
+			++it;
+	}
+#endif
+}
+
+/**
+ * Directories created or moved into the workspace are watched as well, and their
+ * content is reported since files may have been added before the watch was set.
+ *
+ * Files are reported when closed after writing, or moved in (editors often save
+ * through a rename), but not on creation to avoid reading partially written files.
+ */
+void WorkspaceWatcher::_watch_loop(std::stop_token stok)
+{
+#ifdef __linux__
+	alignas(inotify_event) char buffer[64 * 1024];
+	pollfd pfd{_fd, POLLIN, 0};
+
+	while(! stok.stop_requested())
+	{
+		int ready = poll(&pfd, 1, 200);
+		if(ready < 0 && errno != EINTR)
+		{
+			spdlog::error("Workspace watcher failure: {}", std::strerror(errno));
+			_push_event(EventKind::Overflow, {});
+			return;
+		}
+		if(ready <= 0)
+			continue;
+
+		ssize_t len;
+		while((len = read(_fd, buffer, sizeof(buffer))) > 0)
+		{
+			for(char* ptr = buffer; ptr < buffer + len; ptr += sizeof(inotify_event) + reinterpret_cast<inotify_event*>(ptr)->len)
+			{
+				const inotify_event* evt = reinterpret_cast<inotify_event*>(ptr);
+
+				if(evt->mask & IN_Q_OVERFLOW)
+				{
+					spdlog::warn("Workspace watcher queue overflow, some changes were lost.");
+					_push_event(EventKind::Overflow, {});
+					continue;
+				}
+
+				auto dir = _watched_dirs.find(evt->wd);
+				if(dir == _watched_dirs.end())
+					continue;
+
+				if(evt->mask & IN_IGNORED)
+				{
+					_watched_dirs.erase(dir);
+					continue;
+				}
+
+				// Events on the watched directory itself, mostly relevant for the roots
+				// since sub-directories are also reported by their parent.
+				if(evt->len == 0)
+				{
+					if(evt->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+					{
+						fs::path removed = dir->second;
+						_push_event(EventKind::Removed, removed);
+						_unwatch_tree(removed);
+					}
+					continue;
+				}
+
+				fs::path target = dir->second / evt->name;
+				if(_is_excluded(target))
+					continue;
+
+				if(evt->mask & IN_ISDIR)
+				{
+					if(evt->mask & (IN_CREATE | IN_MOVED_TO))
+					{
+						if(! _watch_tree(target, true))
+							_push_event(EventKind::Overflow, {});
+					}
+					else if(evt->mask & (IN_DELETE | IN_MOVED_FROM))
+					{
+						_unwatch_tree(target);
+						_push_event(EventKind::Removed, target);
+					}
+				}
+				else if(evt->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+					_push_event(EventKind::Changed, target);
+				else if(evt->mask & (IN_DELETE | IN_MOVED_FROM))
+					_push_event(EventKind::Removed, target);
+			}
+		}
+	}
+#endif
+}
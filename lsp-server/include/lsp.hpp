@@ -18,9 +18,14 @@
 #include <climits>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <functional>
 #include <optional>
 #include <vector>
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 // For adl_serializer<std::optional<T>>
 #include "index_elements.hpp"
@@ -94,8 +99,50 @@ namespace slsp{
         */
         std::unordered_map<std::string, nlohmann::json> _active_req_args;
 
+        /**
+         * @brief Guards #_uuid, #_bound_callbacks and #_active_req_args, as requests
+         * to the client may be sent from any thread.
+         */
+        std::mutex _callbacks_access;
+
         std::string _current_cb_id;
 
+        /**
+         * @brief Requests (or custom commands) that may be processed by the 
+         * worker pool, concurrently with the main dispatch loop.
+         * 
+         * Handlers of those methods shall only perform read-only operations 
+         * on the server state and shall not send requests to the client.
+         */
+        std::unordered_set<std::string> _concurrent_methods;
+
+        /**
+         * @brief Number of workers started by #run() to process concurrent requests.
+         */
+        unsigned int _worker_count;
+        std::vector<std::jthread> _workers;
+        std::queue<std::function<void()>> _jobs;
+        std::mutex _jobs_access;
+        std::condition_variable_any _jobs_available;
+
+        /**
+         * @brief Stop sources of the client requests being processed or queued, by ID.
+         * Used to handle `$/cancelRequest`.
+         */
+        std::unordered_map<std::string, std::stop_source> _active_requests;
+
+        /**
+         * @brief Cancellations received before the processing of the request started.
+         */
+        std::unordered_set<std::string> _early_cancellations;
+        std::mutex _requests_access;
+        static constexpr std::size_t _max_early_cancellations = 256;
+
+        /**
+         * @brief Cancellation token of the request processed by the current thread.
+         */
+        static thread_local std::stop_token _request_stop_token;
+
         slsp::types::ClientCapabilities _client_capabilities;
 
         void _filter_invocation(const std::string& fct_name) const;
@@ -106,8 +153,86 @@ namespace slsp{
         virtual json _invoke_request(const std::string& fct_name, json& args);
         virtual void _invoke_notif(const std::string& fct_name, json& args);
         virtual void _run_callback(const std::string& id, json& args);
+
+        /**
+         * @brief Check if a reply from the client is expected for the request \p id.
+         */
+        bool _is_callback_expected(const std::string& id);
+
+        /**
+         * @brief Generate a random UUID, from any thread.
+         */
+        std::string _new_uuid();
         
         void _cb_enable_report_token(const nlohmann::json& args);
+
+        /**
+         * @brief Check if a request shall be dispatched to the worker pool.
+         * For `workspace/executeCommand`, the actual command is checked.
+         * 
+         * @param fct Method name
+         * @param params Method parameters
+         * @return true if the request may be processed concurrently.
+         */
+        bool _is_concurrent(const std::string& fct, const json& params) const;
+
+        /**
+         * @brief Queue a request to be processed by the worker pool.
+         * 
+         * @param fct Method name
+         * @param params Method parameters
+         * @param reply Reply skeleton, already holding the request ID.
+         */
+        void _dispatch_concurrent(const std::string& fct, const std::string& id, json&& params, json&& reply);
+
+        /**
+         * @brief Actually process a request and send back the reply.
+         * Used by the worker pool.
+         */
+        void _run_concurrent(const std::string& fct, const std::string& id, std::stop_token stok, json& params, json& reply);
+
+        /**
+         * @brief Handle messages that shall not wait for the processing of 
+         * previous messages (`$/cancelRequest`).
+         * Called from the RPC reception thread.
+         * 
+         * @param msg Incoming message
+         * @return true if the message has been handled.
+         */
+        bool _filter_priority_message(nlohmann::json& msg);
+
+        /**
+         * @brief Request the cancellation of the request with the ID \p id.
+         * If the request is not yet known, the cancellation is recorded and will 
+         * be applied upon reception.
+         */
+        void _cancel_request(const std::string& id);
+
+        /**
+         * @brief Record a request as active, thus cancellable.
+         * 
+         * @param id ID of the request
+         * @return std::stop_token the cancellation token of the request.
+         */
+        std::stop_token _begin_request(const std::string& id);
+        void _end_request(const std::string& id);
+
+        /**
+         * @brief Get the cancellation token of the request being processed by the calling thread.
+         * This can be used by long processing to check for cancellation.
+         */
+        static inline std::stop_token _current_request_token() {return _request_stop_token;};
+
+        /**
+         * @brief Throw a lsp_request_cancelled_error if the request being processed by the 
+         * calling thread has been cancelled by the client.
+         * This shall be called regularly in long handlers.
+         */
+        static void _throw_if_cancelled();
+
+        void _worker_loop(std::stop_token stok);
+        void _start_workers();
+        void _stop_workers();
         /**
          * @brief Implements RAII for CB ressource liberation management
          * 
@@ -118,6 +243,17 @@ namespace slsp{
             ~_CallbackContextHandler();
         };
 
+        /**
+         * @brief Implements RAII for the cancellation context of a request being processed.
+         * Sets the cancellation token of the current thread and release the request on destruction.
+         */
+        struct _RequestContextHandler {
+            const std::string id;
+            BaseLSP* tgt;
+            _RequestContextHandler(const std::string& req_id, BaseLSP* lsp, std::stop_token stok);
+            ~_RequestContextHandler();
+        };
+
     public:
         /**
          * @brief Construct a new BaseLSP object
@@ -126,11 +262,19 @@ namespace slsp{
          * @param os Output data stream (from server to client)
          */
         explicit BaseLSP(std::istream& is = std::cin, std::ostream& os = std::cout);
+        virtual ~BaseLSP();
 
         void bind_request(const std::string& fct_name, std::function<json(json&)> cb, bool allow_override = false);
         void bind_notification(const std::string& fct_name, std::function<void(json&)> cb, bool allow_override = false);
         void bind_callback(const std::string& id, std::function<void(json&)> cb, bool allow_override = false);
 
+        /**
+         * @brief Allow a bound request to be processed concurrently by the worker pool.
+         * 
+         * @param fct_name Name of the request or custom command.
+         */
+        void set_concurrent(const std::string& fct_name);
+
         std::optional<json> invoke(const std::string& fct, json& params);
         
         bool is_notif(const std::string& fct) const;
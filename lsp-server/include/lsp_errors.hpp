@@ -95,6 +95,11 @@ namespace slsp {
     MAKE_BASIC_RPC_EXCEPTION(lsp_unknown_error, types::ErrorCodes_UnknownErrorCode);
     MAKE_BASIC_RPC_EXCEPTION(lsp_request_failed_exception, types::LSPErrorCodes_RequestFailed);
 
+    /**
+     * @brief The request has been cancelled by the client through `$/cancelRequest`.
+     */
+    MAKE_BASIC_RPC_EXCEPTION_WITH_MSG(lsp_request_cancelled_error, types::LSPErrorCodes_RequestCancelled, "Request cancelled.")
+
     void to_json(nlohmann::json& j, const rpc_base_exception& e);
    
 
@@ -5,9 +5,13 @@
 #include <condition_variable>
 
 #include <chrono>
+#include <functional>
+#include <optional>
 #include <queue>
 #include <istream>
 #include <ostream>
+#include <string>
+#include <vector>
 
 
 namespace rpc
@@ -15,8 +19,45 @@ namespace rpc
     class RPCPipeTransport
     {
     protected:
+        /**
+         * @brief Outgoing message, already framed and ready to be written.
+         * 
+         * The content is serialized after a reserved area of #_tx_header_room bytes
+         * in which the header is then written, right-aligned against the content.
+         * The message to write is therefore `buffer[start:]`
+         */
+        struct _OutMessage
+        {
+            std::string buffer;
+            std::size_t start;
+        };
+
+        /**
+         * @brief Room reserved at the begining of each outgoing buffer for the header.
+         */
+        static constexpr std::size_t _tx_header_room = 96;
+
+        /**
+         * @brief Maximum number of spare buffers kept in #_tx_pool.
+         */
+        static constexpr std::size_t _tx_pool_size = 16;
+
         std::queue<nlohmann::json> _inbox;
-        std::queue<nlohmann::json> _outbox;
+        std::queue<_OutMessage> _outbox;
+
+        /**
+         * @brief Called by the reception thread on each incoming message, 
+         * before queuing it in the #_inbox. 
+         * If it returns true, the message is considered as handled and is not queued.
+         * Protected by #_rx_access
+         */
+        std::function<bool(nlohmann::json&)> _priority_filter;
+
+        /**
+         * @brief Spare output buffers, reused between messages to avoid 
+         * reallocating for each outgoing message. Protected by #_tx_access
+         */
+        std::vector<std::string> _tx_pool;
 
         std::mutex _rx_access;
         std::mutex _tx_access;
@@ -30,6 +71,11 @@ namespace rpc
 
         std::condition_variable _data_available;
 
+        /**
+         * @brief Wakes up the #_outbox_manager as soon as data is pushed to the #_outbox.
+         */
+        std::condition_variable_any _outbox_ready;
+
         std::jthread _inbox_manager;
         std::jthread _outbox_manager;
 
@@ -40,6 +86,17 @@ namespace rpc
 
         bool _use_endl;
 
+        /**
+         * @brief Reception buffer, reused between messages to avoid
+         * reallocating on each incoming payload.
+         */
+        std::string _rx_buffer;
+
+        /**
+         * @brief Holds the header line being parsed by #_get_json.
+         */
+        std::string _rx_header;
+
         /**
          * @brief This function will retrieve data from the input
          * stream ::_in and transfer it (as json) to the #_inbox.
@@ -54,6 +111,8 @@ namespace rpc
         /**
          * @brief This function wait for data to be in the #_outbox and then
          * transfer it through the medium provided by #_out .
+         * All messages pending when waking up are written in a single batch,
+         * followed by a single flush.
          * 
          * @param stok Stop token to gracefully handle stop of operations.
          */
@@ -69,15 +128,61 @@ namespace rpc
          */
         nlohmann::json _get_json(std::stop_token& stok);
 
+        /**
+         * @brief Write all messages from \p pending to #_out, then flush.
+         * Buffers are given back to #_tx_pool afterward.
+         * 
+         * @param pending Messages to write, emptied by the call.
+         */
+        void _write_batch(std::queue<_OutMessage>& pending);
+
+        /**
+         * @brief Serialize and frame \p data into a buffer taken from #_tx_pool.
+         * 
+         * @param data Message to serialize
+         * @return The framed message.
+         */
+        _OutMessage _frame(const nlohmann::json& data);
+
+        /**
+         * @brief Read the header part of a RPC message and extract the announced
+         * content length.
+         * 
+         * @return the value of the `Content-Length` header if any, empty otherwise.
+         */
+        std::optional<std::size_t> _read_header();
+
     public:
         RPCPipeTransport() = delete;
         RPCPipeTransport(std::istream &input, std::ostream &output);
         ~RPCPipeTransport();
 
+        /**
+         * @brief Queue \p data for sending. 
+         * The `jsonrpc` field is added in place and the message is directly serialized
+         * into the output buffer.
+         */
+        void send(nlohmann::json&& data);
+
+        /**
+         * @brief Queue a copy of \p data for sending.
+         * Prefer the rvalue overload which avoids the copy.
+         */
         void send(const nlohmann::json& data);
         void abort();
         void close();
         inline void set_endl(const bool use_endl) {_use_endl = use_endl;};
+
+        /**
+         * @brief Set the function used to handle high-priority messages (such as 
+         * `$/cancelRequest`) as soon as they are received, without waiting for 
+         * the processing of the previous messages.
+         * 
+         * @param filter Function called by the reception thread on each message, 
+         * which returns true if the message has been handled.
+         * @warning The filter is called from the reception thread and shall be fast.
+         */
+        void set_priority_filter(std::function<bool(nlohmann::json&)> filter);
         inline bool is_closed() const { return _closed || _aborted; };
         nlohmann::json get();
     };
@@ -22,7 +22,7 @@ namespace slsp {
             // char _txbuf[512];
 
             std::streamsize xsputn(const char_type* s, std::streamsize n) override;
-            // std::streamsize xsgetn(char_type* s, std::streamsize n) override;
+            std::streamsize xsgetn(char_type* s, std::streamsize n) override;
             int underflow() override;
 
 
@@ -32,11 +32,27 @@ namespace slsp{
     BaseLSP::_CallbackContextHandler::~_CallbackContextHandler()
     {
         spdlog::debug("Freeing cb ressources through RAII with id {}",id);
+        std::lock_guard<std::mutex> lock(tgt->_callbacks_access);
         tgt->_bound_callbacks.erase(id);
         tgt->_active_req_args.erase(id);
 
     }
 
+    thread_local std::stop_token BaseLSP::_request_stop_token;
+
+    BaseLSP::_RequestContextHandler::_RequestContextHandler(const std::string& req_id, BaseLSP* lsp, std::stop_token stok) :
+        id(req_id),
+        tgt(lsp)
+    {
+        _request_stop_token = stok;
+    }
+
+    BaseLSP::_RequestContextHandler::~_RequestContextHandler()
+    {
+        _request_stop_token = std::stop_token();
+        tgt->_end_request(id);
+    }
+
     BaseLSP::BaseLSP(std::istream& is, std::ostream& os) : 
     _is_stopping(false),
     _is_stopped(false),
@@ -47,13 +63,23 @@ namespace slsp{
     _bound_notifs(),
     _uuid(&_rand_engine),
     capabilities(),
-    _unpack_args_for_customs(false)
+    _unpack_args_for_customs(false),
+    _worker_count(std::clamp(std::thread::hardware_concurrency(),2U,4U))
     {
         std::random_device rd;
         auto seed_data = std::array<int, std::mt19937::state_size> {};
         std::generate(std::begin(seed_data), std::end(seed_data), std::ref(rd));
         std::seed_seq seq(std::begin(seed_data), std::end(seed_data));
         _rand_engine = std::mt19937(seq);
+
+        _rpc.set_priority_filter([this](json& msg) { return _filter_priority_message(msg); });
+    }
+
+    BaseLSP::~BaseLSP()
+    {
+        // The reception thread lives as long as the transport, 
+        // it shall not call back a destroyed object.
+        _rpc.set_priority_filter(nullptr);
     }
                         
     void BaseLSP::_filter_invocation(const std::string& fct_name) const
@@ -103,26 +129,52 @@ namespace slsp{
 
     void BaseLSP::bind_callback(const std::string& id, notification_handle_t cb, bool allow_override)
     {
+        std::lock_guard<std::mutex> lock(_callbacks_access);
         _bound_callbacks[id] = cb;
     }
 
+    void BaseLSP::set_concurrent(const std::string& fct_name)
+    {
+        _concurrent_methods.insert(fct_name);
+    }
+
     void BaseLSP::_run_callback(const std::string& id, json& params)
     {
+        std::unique_lock<std::mutex> lock(_callbacks_access);
         if(! _bound_callbacks.contains(id))
             return;
 
         spdlog::info("Got callback for id {}",id);
 
         auto cb = _bound_callbacks.extract(id);
+        lock.unlock();
+
         _current_cb_id = id;
         cb.mapped()(params);
     }
 
+    std::string BaseLSP::_new_uuid()
+    {
+        std::lock_guard<std::mutex> lock(_callbacks_access);
+        return uuids::to_string(_uuid());
+    }
+
+    bool BaseLSP::_is_callback_expected(const std::string& id)
+    {
+        std::lock_guard<std::mutex> lock(_callbacks_access);
+        return _bound_callbacks.contains(id);
+    }
+
     void BaseLSP::_cb_enable_report_token(const nlohmann::json& _)
     {
         if(_client_capabilities.window && _client_capabilities.window->workDoneProgress.value_or(false))
         {
-            slsp::types::WorkDoneProgressCreateParams params = _active_req_args.at(_current_cb_id);
+            json args;
+            {
+                std::lock_guard<std::mutex> lock(_callbacks_access);
+                args = _active_req_args.at(_current_cb_id);
+            }
+            slsp::types::WorkDoneProgressCreateParams params = args;
             _active_progress_tokens.emplace(params.token,false);
         }
     }
@@ -238,6 +290,157 @@ namespace slsp{
         }        
     }
 
+    bool BaseLSP::_is_concurrent(const std::string& fct, const json& params) const
+    {
+        if(fct == "workspace/executeCommand")
+            return params.contains("command") 
+                && params["command"].is_string() 
+                && _concurrent_methods.contains(params["command"].template get<std::string>());
+
+        return _concurrent_methods.contains(fct);
+    }
+
+    void BaseLSP::_dispatch_concurrent(const std::string& fct, const std::string& id, json&& params, json&& reply)
+    {
+        // Recorded right away to allow cancelling queued requests.
+        std::stop_token stok = _begin_request(id);
+        {
+            std::lock_guard<std::mutex> lock(_jobs_access);
+            _jobs.emplace([this, fct, id, stok, params = std::move(params), reply = std::move(reply)]() mutable {
+                _run_concurrent(fct, id, stok, params, reply);
+            });
+        }
+        _jobs_available.notify_one();
+    }
+
+    void BaseLSP::_run_concurrent(const std::string& fct, const std::string& id, std::stop_token stok, json& params, json& reply)
+    {
+        std::string cmd_name = fct;
+        if(fct == "workspace/executeCommand")
+            cmd_name += "/" + params["command"].template get<std::string>();
+
+        _RequestContextHandler req_ctx(id, this, stok);
+        try
+        {
+            _throw_if_cancelled();
+            spdlog::stopwatch sw;
+            reply["result"] = invoke(fct,params).value_or(json());
+            spdlog::info("Method {} concurrent invocation done in {:.3}s",cmd_name,sw);
+        }
+        catch (const rpc_base_exception& e)
+        {
+            spdlog::error("Catched rpc_base_exception: {}",e.what());
+            reply["error"] = e;
+        }
+        catch (const server_side_base_exception& e)
+        {
+            spdlog::error("Unexpected server side error: {}", e.what());
+            return;
+        }
+        catch (const std::exception& e)
+        {
+            spdlog::error("Got unknown error during the handling of {}: {}",cmd_name, e.what());
+            reply["error"] = lsp_unknown_error(e.what());
+        }
+
+        _rpc.send(std::move(reply));
+    }
+
+    bool BaseLSP::_filter_priority_message(json& msg)
+    {
+        if(! msg.contains("method") || msg.at("method") != "$/cancelRequest")
+            return false;
+
+        if(msg.contains("params") && msg.at("params").contains("id"))
+        {
+            const json& id = msg.at("params").at("id");
+            if (id.is_string())
+                _cancel_request(id.template get<std::string>());
+            else if (id.is_number())
+                _cancel_request(std::to_string(id.template get<int>()));
+        }
+        return true;
+    }
+
+    void BaseLSP::_cancel_request(const std::string& id)
+    {
+        std::lock_guard<std::mutex> lock(_requests_access);
+        auto it = _active_requests.find(id);
+        if(it != _active_requests.end())
+        {
+            spdlog::info("Cancel request {}",id);
+            it->second.request_stop();
+        }
+        else
+        {
+            // Either not received yet or already done. 
+            // Bound the record as the latter will never be cleaned up.
+            if(_early_cancellations.size() >= _max_early_cancellations)
+                _early_cancellations.clear();
+            _early_cancellations.insert(id);
+        }
+    }
+
+    std::stop_token BaseLSP::_begin_request(const std::string& id)
+    {
+        std::lock_guard<std::mutex> lock(_requests_access);
+        std::stop_source& ss = _active_requests[id];
+        if(_early_cancellations.erase(id))
+        {
+            spdlog::info("Cancel request {}",id);
+            ss.request_stop();
+        }
+        return ss.get_token();
+    }
+
+    void BaseLSP::_end_request(const std::string& id)
+    {
+        std::lock_guard<std::mutex> lock(_requests_access);
+        _active_requests.erase(id);
+    }
+
+    void BaseLSP::_throw_if_cancelled()
+    {
+        if(_request_stop_token.stop_requested())
+            throw lsp_request_cancelled_error();
+    }
+
+    void BaseLSP::_worker_loop(std::stop_token stok)
+    {
+        std::function<void()> job;
+        while(true)
+        {
+            {
+                std::unique_lock lock(_jobs_access);
+                _jobs_available.wait(lock, stok, [this] { return !_jobs.empty(); });
+                
+                // Pending jobs are still processed upon stop request.
+                if(_jobs.empty())
+                    break;
+
+                job = std::move(_jobs.front());
+                _jobs.pop();
+            }
+            job();
+        }
+    }
+
+    void BaseLSP::_start_workers()
+    {
+        spdlog::info("Start {} workers for concurrent requests.",_worker_count);
+        for(unsigned int i = 0; i < _worker_count; i++)
+            _workers.emplace_back(std::bind_front(&BaseLSP::_worker_loop, this));
+    }
+
+    void BaseLSP::_stop_workers()
+    {
+        for(std::jthread& worker : _workers)
+            worker.request_stop();
+        
+        // jthread destructor joins.
+        _workers.clear();
+    }
+
     bool BaseLSP::is_notif(const std::string &fct) const
     {
         return _bound_notifs.contains(fct);
@@ -312,9 +515,9 @@ namespace slsp{
         to_send["jsonrpc"] = "2.0";
         to_send["method"] = fct;
         if(! params.is_null())
-            to_send["params"] = params;
+            to_send["params"] = std::move(params);
         
-        _rpc.send(to_send);
+        _rpc.send(std::move(to_send));
     }
 
 
@@ -322,22 +525,28 @@ namespace slsp{
     void BaseLSP::send_request(const std::string &fct,std::function<void(json&)> cb, nlohmann::json &&params)
     {
         json to_send;
-        std::string req_id = uuids::to_string(_uuid());
+        std::string req_id;
+        {
+            // The callback shall be bound before the request is sent,
+            // as the reply may come right away.
+            std::lock_guard<std::mutex> lock(_callbacks_access);
+            req_id = uuids::to_string(_uuid());
+            _active_req_args.emplace(req_id, params);
+            _bound_callbacks[req_id] = cb;
+        }
         to_send["jsonrpc"] = "2.0";
         to_send["method"] = fct;
         to_send["id"] = req_id;
         if(! params.is_null())
             to_send["params"] = params;
 
-        _active_req_args.emplace(req_id, params);
         spdlog::info("Sending request {} with id {}", fct, req_id);
-        bind_callback(req_id, cb);
-        _rpc.send(to_send);
+        _rpc.send(std::move(to_send));
     }
 
     const std::string BaseLSP::create_progress_report()
     {
-        std::string token = uuids::to_string(_uuid());
+        std::string token = _new_uuid();
         slsp::types::WorkDoneProgressCreateParams params = {.token=token};
         send_request("window/workDoneProgress/create", LSP_MEMBER_BIND(BaseLSP,_cb_enable_report_token),params);
         return token;
@@ -382,6 +591,7 @@ namespace slsp{
     void BaseLSP::run()
     {
         std::optional<std::string> id;
+        _start_workers();
         while(! _rpc.is_closed() && ! _is_stopped)
         {
             // Reset all parsed content
@@ -446,8 +656,24 @@ namespace slsp{
 
                     if (raw_input.contains("params"))
                     {
-                        params = raw_input["params"];
+                        params = std::move(raw_input["params"]);
+                    }
+
+                    if(has_id && is_request(method) && _is_concurrent(method,params))
+                    {
+                        // Fail early on invalid state, otherwise let the workers reply.
+                        _filter_invocation(method);
+                        _dispatch_concurrent(method,id.value(),std::move(params),std::move(ret));
+                        continue;
+                    }
+
+                    std::optional<_RequestContextHandler> req_ctx;
+                    if(has_id)
+                    {
+                        req_ctx.emplace(id.value(),this,_begin_request(id.value()));
+                        _throw_if_cancelled();
                     }
+
                     spdlog::stopwatch sw;
                     fct_ret = invoke(method,params);
                     std::string cmd_name = method;
@@ -461,7 +687,7 @@ namespace slsp{
                 else if(has_id)
                 {
                     // Might be the return from a server initiated request.
-                    if(_bound_callbacks.contains(id.value()))
+                    if(_is_callback_expected(id.value()))
                     {
                         _CallbackContextHandler raii{.id=id.value(),.tgt=this};
 
@@ -486,7 +712,7 @@ namespace slsp{
                 
                 if (fct_ret.has_value())
                 {
-                    ret["result"] = fct_ret.value();
+                    ret["result"] = std::move(fct_ret.value());
                     require_send = true;
                 }
             }
@@ -517,9 +743,10 @@ namespace slsp{
                 // if(id)
                 //     ret["id"] = id.value();
                 spdlog::trace("Sending back {}",ret.dump(1));
-                ret["jsonrpc"] = "2.0";
-                _rpc.send(ret);
+                _rpc.send(std::move(ret));
             }
         }
+
+        _stop_workers();
     }
 }
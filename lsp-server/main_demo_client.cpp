@@ -6,6 +6,9 @@
 #include <thread>
 #include "nlohmann/json.hpp"
 #include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include <vector>
 int server(in_port_t port, bool should_reply)
 {
     slsp::TCPInterfaceServer itf = slsp::TCPInterfaceServer(port);
@@ -162,6 +165,162 @@ int client(in_port_t port, bool expect_reply)
     return 0;
 }
 
+/**
+ * @brief Send a single framed RPC message on the connection.
+ */
+static bool send_message(sockpp::tcp_connector& conn, const nlohmann::json& msg)
+{
+    std::string payload = msg.dump();
+    std::string to_send = "Content-Length: " + std::to_string(payload.length()) + "\r\n\r\n" + payload;
+    if(conn.write(to_send) != ssize_t(to_send.length()))
+    {
+        spdlog::error("Error writing to TCP stream: {}",conn.last_error_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Read a single framed RPC message from the connection.
+ * 
+ * @param conn Connection to read from
+ * @param rx Reception buffer, holds any data received beyond the returned message.
+ * @param msg Output message
+ * @return true on success, false if the connection was closed.
+ */
+static bool read_message(sockpp::tcp_connector& conn, std::string& rx, nlohmann::json& msg)
+{
+    char buffer[4096];
+    while(true)
+    {
+        std::size_t header_end = rx.find("\r\n\r\n");
+        if(header_end != std::string::npos)
+        {
+            std::size_t len_pos = rx.find("Content-Length:");
+            if(len_pos == std::string::npos || len_pos > header_end)
+            {
+                spdlog::error("Received a message without Content-Length");
+                return false;
+            }
+
+            std::size_t length = std::stoul(rx.substr(len_pos + 15, header_end - len_pos - 15));
+            std::size_t body_start = header_end + 4;
+            if(rx.length() >= body_start + length)
+            {
+                msg = nlohmann::json::parse(rx.cbegin() + body_start, rx.cbegin() + body_start + length);
+                rx.erase(0,body_start + length);
+                return true;
+            }
+        }
+
+        int n = conn.read(buffer, sizeof(buffer));
+        if(n <= 0)
+            return false;
+        rx.append(buffer,n);
+    }
+}
+
+/**
+ * @brief Wait for the reply to the request \p id, discarding everything else.
+ */
+static bool await_reply(sockpp::tcp_connector& conn, std::string& rx, int id)
+{
+    nlohmann::json msg;
+    while(read_message(conn,rx,msg))
+    {
+        if(! msg.contains("method") && msg.contains("id") && msg["id"] == id)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Measure the round-trip latency of `textDocument/definition` requests
+ * against a running LSP (in TCP mode).
+ * 
+ * The file is saved once to trigger the indexing, then some warmup requests are 
+ * sent before the timed ones. Requests are sent one at a time.
+ * 
+ * @param port Port on which the LSP is listening
+ * @param file File to look into. Its parent directory is used as the workspace root.
+ * @param line Line of the symbol to look for (0-based)
+ * @param character Column of the symbol to look for (0-based)
+ * @param count Number of timed requests
+ * @return Process return code
+ */
+int bench(in_port_t port, const std::filesystem::path& file, unsigned int line, unsigned int character, unsigned int count)
+{
+    using namespace std::chrono_literals;
+    using clock = std::chrono::steady_clock;
+    constexpr unsigned int warmup = 10;
+
+    spdlog::info("Trying to connect to localhost:{} (5s...)", port);
+    sockpp::tcp_connector conn({"localhost", port}, 5s);
+    if(!conn)
+    {
+        spdlog::error("Did not manage to connect in time: {}",conn.last_error_str());
+        return 1;
+    }
+    conn.read_timeout(60s);
+
+    std::filesystem::path abs_file = std::filesystem::absolute(file);
+    std::string file_uri = "file://" + abs_file.generic_string();
+    std::string root_uri = "file://" + abs_file.parent_path().generic_string();
+
+    std::string rx;
+    int id = 0;
+
+    send_message(conn,{{"jsonrpc","2.0"},{"id",id},{"method","initialize"},
+        {"params",{{"processId",nullptr},{"rootUri",root_uri},{"capabilities",nlohmann::json::object()}}}});
+    if(! await_reply(conn,rx,id))
+    {
+        spdlog::error("No reply to initialize.");
+        return 1;
+    }
+    send_message(conn,{{"jsonrpc","2.0"},{"method","initialized"},{"params",nlohmann::json::object()}});
+    send_message(conn,{{"jsonrpc","2.0"},{"method","textDocument/didSave"},
+        {"params",{{"textDocument",{{"uri",file_uri}}}}}});
+
+    nlohmann::json def_params = {
+        {"textDocument",{{"uri",file_uri}}},
+        {"position",{{"line",line},{"character",character}}}
+    };
+
+    std::vector<double> latencies;
+    latencies.reserve(count);
+    for(unsigned int i = 0; i < warmup + count; i++)
+    {
+        id++;
+        clock::time_point start = clock::now();
+        send_message(conn,{{"jsonrpc","2.0"},{"id",id},{"method","textDocument/definition"},{"params",def_params}});
+        if(! await_reply(conn,rx,id))
+        {
+            spdlog::error("Connection lost while waiting for reply {}",id);
+            return 1;
+        }
+        if(i >= warmup)
+            latencies.push_back(std::chrono::duration<double,std::micro>(clock::now() - start).count());
+    }
+
+    send_message(conn,{{"jsonrpc","2.0"},{"id",++id},{"method","shutdown"},{"params",nullptr}});
+    await_reply(conn,rx,id);
+    send_message(conn,{{"jsonrpc","2.0"},{"method","exit"},{"params",nullptr}});
+
+    if(latencies.empty())
+        return 0;
+
+    std::sort(latencies.begin(),latencies.end());
+    auto percentile = [&latencies](unsigned int p) { 
+        return latencies[std::min<std::size_t>(latencies.size() - 1, (latencies.size() * p) / 100)]; 
+    };
+
+    spdlog::info("textDocument/definition round-trip over {} requests:",latencies.size());
+    spdlog::info("   p50 : {:.1f} us",percentile(50));
+    spdlog::info("   p99 : {:.1f} us",percentile(99));
+    spdlog::info("   max : {:.1f} us",latencies.back());
+    return 0;
+}
+
 int main(int argc, char** argv) {
     argparse::ArgumentParser prog("Demo TCP data sender", "0.0.1");
     prog.add_argument("--port","-p")
@@ -179,6 +338,24 @@ int main(int argc, char** argv) {
         .default_value(false)
         .implicit_value(true);
 
+    prog.add_argument("--bench")
+        .help("Measure textDocument/definition latency on the given file against a running LSP");
+
+    prog.add_argument("--line")
+        .help("Benchmark: line of the symbol to lookup (0-based)")
+        .default_value<unsigned int>(0)
+        .scan<'u', unsigned int>();
+
+    prog.add_argument("--character")
+        .help("Benchmark: column of the symbol to lookup (0-based)")
+        .default_value<unsigned int>(0)
+        .scan<'u', unsigned int>();
+
+    prog.add_argument("--count")
+        .help("Benchmark: number of timed requests")
+        .default_value<unsigned int>(200)
+        .scan<'u', unsigned int>();
+
 
     try {
         prog.parse_args(argc, argv);
@@ -193,6 +370,12 @@ int main(int argc, char** argv) {
     in_port_t port = prog.get<in_port_t>("--port");
     bool bidir = prog.get<bool>("--bidir");
 
+    if(prog.is_used("--bench"))
+        return bench(port, prog.get<std::string>("--bench"),
+            prog.get<unsigned int>("--line"),
+            prog.get<unsigned int>("--character"),
+            prog.get<unsigned int>("--count"));
+
     if(prog.get<bool>("--client"))
         return client(port,bidir);
     else
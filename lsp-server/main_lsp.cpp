@@ -1,5 +1,6 @@
 #include <iostream>
 #include <memory>
+#include <string_view>
 #include "argparse/argparse.hpp"
 #include "spdlog/sinks/stdout_color_sinks.h"
 #include "spdlog/spdlog.h"
@@ -75,6 +76,10 @@ void runner(slsp::BaseLSP& lsp)
 }
 
 int main(int argc, char** argv) {
+    // Compilation process started by the server, which has no client.
+    if(argc == 2 && std::string_view(argv[1]) == DiplomatLSP::compile_worker_flag)
+        return DiplomatLSP::run_compile_worker();
+
     argparse::ArgumentParser prog("slang Language server", DIPLOMAT_VERSION_STRING );
     prog.add_argument("--tcp")
         .help("Use a TCP connection")
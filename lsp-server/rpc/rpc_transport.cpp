@@ -3,7 +3,14 @@
 #include <chrono>
 #include <istream>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <charconv>
+#include <cctype>
+#include <algorithm>
+#include <array>
+#include <ostream>
+#include <streambuf>
 #include "spdlog/spdlog.h"
 #include "fmt/format.h"
 #include "lsp_errors.hpp"
@@ -12,6 +19,35 @@ using json = nlohmann::json;
 using namespace std::chrono_literals;
 
 namespace rpc {
+    namespace {
+        /**
+         * @brief Stream buffer that appends everything written to it at the end
+         * of a string, such that a json can be serialized in place through `operator<<`
+         */
+        class StringAppendBuffer : public std::streambuf
+        {
+        public:
+            explicit StringAppendBuffer(std::string& target) : _target(target) {};
+
+        protected:
+            int_type overflow(int_type ch) override
+            {
+                if(! traits_type::eq_int_type(ch,traits_type::eof()))
+                    _target.push_back(traits_type::to_char_type(ch));
+                return traits_type::not_eof(ch);
+            }
+
+            std::streamsize xsputn(const char_type* s, std::streamsize count) override
+            {
+                _target.append(s,static_cast<std::size_t>(count));
+                return count;
+            }
+
+        private:
+            std::string& _target;
+        };
+    }
+
 RPCPipeTransport::RPCPipeTransport(std::istream& input, std::ostream& output) :
     _inbox(),
     _outbox(),
@@ -45,89 +81,101 @@ RPCPipeTransport::RPCPipeTransport(std::istream& input, std::ostream& output) :
 
 
     /**
-     * This function will wait for the proper start of the payload
-     * of a RPC call (new line then '`{`' character ) while discarding
-     * other data.
-     * It will then capture all characters until the first brace is closed, denoting
-     * the end of the JSON segment.
+     * Header lines are read until the empty line that separates them from the content.
+     * Empty lines found before any header (such as a trailing line terminator sent after
+     * the previous message) are skipped.
+     * 
+     * Header names are matched case-insensitively, as for HTTP. Only `Content-Length`
+     * is used, other headers (`Content-Type`) are ignored.
+     */
+    std::optional<std::size_t> RPCPipeTransport::_read_header()
+    {
+        constexpr std::string_view length_header = "content-length";
+        std::optional<std::size_t> content_length;
+        bool got_header = false;
+
+        while (std::getline(_in, _rx_header))
+        {
+            if(! _rx_header.empty() && _rx_header.back() == '\r')
+                _rx_header.pop_back();
+
+            if(_rx_header.empty())
+            {
+                if(got_header)
+                    break;
+                else
+                    continue;
+            }
+
+            got_header = true;
+            std::size_t sep = _rx_header.find(':');
+            if(sep == std::string::npos)
+            {
+                spdlog::trace("Skipped data in header: {}",_rx_header);
+                continue;
+            }
+
+            std::string_view name(_rx_header.data(), sep);
+            std::string_view value(_rx_header.data() + sep + 1, _rx_header.size() - sep - 1);
+            while(! value.empty() && value.front() == ' ')
+                value.remove_prefix(1);
+
+            if(name.size() == length_header.size() 
+                && std::equal(name.cbegin(),name.cend(),length_header.cbegin(),
+                    [](char a, char b){return std::tolower(static_cast<unsigned char>(a)) == b;}))
+            {
+                std::size_t length;
+                auto [ptr, ec] = std::from_chars(value.data(),value.data() + value.size(),length);
+                if(ec == std::errc())
+                    content_length = length;
+                else
+                    spdlog::error("Invalid Content-Length value '{}'",value);
+            }
+        }
+
+        return content_length;
+    }
+
+    /**
+     * This function reads the message header to get the announced `Content-Length`,
+     * then reads the whole content in a single bulk read into #_rx_buffer before 
+     * parsing it in place.
      *
-     * This JSON is then parsed and returned.
-     * Upon failure, the function will try to flush the input stream _in to avoid potential
-     * corrupted data. Upon resuming, the function will not capture anything before having a proper
-     * start of JSON.
+     * A message without a valid `Content-Length` header is discarded.
+     * Upon a parsing failure, the message is discarded as well. As the framing is known,
+     * the stream stays synchronized on the next message.
      *
-     * @note It is required for this function to handle each characters in order to be 
-     * as non-blocking as possible to handle \p stok .
-     *  
+     * @note The reads are blocking. The stop token is checked between messages.
      */
     json RPCPipeTransport::_get_json(std::stop_token& stok)
     {
-        std::string buf;
-        using namespace std::chrono_literals;
+        std::optional<std::size_t> content_length;
 
-        int json_idx = 0;
-        bool in_string = false; 
+        if(! stok.stop_requested())
+            content_length = _read_header();
 
-        char last_char = 0;
-        char new_char = 0;
+        if(! stok.stop_requested() && ! _in.eof() && content_length)
+        {
+            _rx_buffer.resize(content_length.value());
+            _in.read(_rx_buffer.data(),content_length.value());
 
-        while (! _in.eof() && ! stok.stop_requested()) {
-            // If "something" is waiting to be read
-            if(_in.peek() != EOF)
+            if(static_cast<std::size_t>(_in.gcount()) == content_length.value())
             {
-                last_char = new_char;
-                new_char = _in.get();
-
-                buf.push_back(new_char);
-                
-                // Skip everything as long as we don't have at least one
-                // level of json ( '{' )
-                if(json_idx == 0)
+                try 
                 {
-                    if(! in_string && last_char == '\n' && new_char == '{')
-                    {
-                        spdlog::trace("Skipped data before json :\n{}",buf);
-                        buf.clear();
-                        json_idx ++;
-                        // As we cleared the buffer, re-insert the brace.
-                        buf.push_back(new_char);
-                    }
-                }
-                else 
+                    return json::parse(_rx_buffer.cbegin(),_rx_buffer.cend());
+                } 
+                catch (const nlohmann::json::parse_error& e) 
                 {
-                    if(new_char == '"' && last_char != '\\')
-                            in_string = !in_string;
-                    else if(! in_string)
-                    {
-                        if(new_char == '{')
-                            json_idx ++;
-                        else if(new_char == '}')
-                            json_idx --;
-                    }
-                    
-                    if(json_idx == 0)
-                    {
-                        // Parse the received data
-                        try 
-                        {
-                            return json::parse(buf);
-                        } 
-                        catch (nlohmann::json::parse_error e) 
-                        {
-                            spdlog::error("Ignored ill-formed JSON input : {}\nBuffer was {}", std::string(e.what()),buf);
-                            // Cleanup                            
-                            while(_in.rdbuf()->in_avail())
-                                _in.get();
-
-                            return json();
-                        }
-                    }
+                    spdlog::error("Ignored ill-formed JSON input : {}\nBuffer was {}", std::string(e.what()),_rx_buffer);
+                    return json();
                 }
             }
-            else 
-            {
-                std::this_thread::sleep_for(100ms);
-            }
+        }
+        else if (! stok.stop_requested() && ! _in.eof())
+        {
+            spdlog::error("Discarded incoming message without Content-Length header.");
+            return json();
         }
 
         if(! stok.stop_requested() && _in.eof())
@@ -156,13 +204,18 @@ RPCPipeTransport::RPCPipeTransport(std::istream& input, std::ostream& output) :
             spdlog::trace("Captured data {}", new_message.dump(1));
             if(! new_message.empty())
             {
+                bool handled = false;
                 // Push new json
                 {
                     std::lock_guard<std::mutex> lock(_rx_access);
-                    _inbox.push(new_message);
+                    if(_priority_filter)
+                        handled = _priority_filter(new_message);
+                    if(! handled)
+                        _inbox.push(std::move(new_message));
                 }
 
-                _data_available.notify_all();
+                if(! handled)
+                    _data_available.notify_all();
             }
         }
 
@@ -173,42 +226,100 @@ RPCPipeTransport::RPCPipeTransport(std::istream& input, std::ostream& output) :
     }
 
 
+    RPCPipeTransport::_OutMessage RPCPipeTransport::_frame(const json& data)
+    {
+        _OutMessage msg;
+        {
+            std::lock_guard<std::mutex> lock(_tx_access);
+            if(! _tx_pool.empty())
+            {
+                msg.buffer = std::move(_tx_pool.back());
+                _tx_pool.pop_back();
+            }
+        }
+
+        // Serialize directly after the room reserved for the header.
+        // A zero width gives the compact output, invalid UTF-8 throws.
+        msg.buffer.assign(_tx_header_room,' ');
+        StringAppendBuffer appender(msg.buffer);
+        std::ostream content(&appender);
+        content << data;
+
+        std::size_t content_length = msg.buffer.size() - _tx_header_room;
+
+        if(_use_endl)
+            msg.buffer.push_back('\n');
+
+        std::array<char,_tx_header_room> header;
+        auto res = fmt::format_to_n(header.begin(),header.size(),
+                "Content-Length: {}\r\n"
+                "Content-Type: application/vscode-jsonrpc; charset=utf-8\r\n"
+                "\r\n"
+                ,content_length);
+
+        msg.start = _tx_header_room - res.size;
+        std::copy_n(header.cbegin(),res.size,msg.buffer.begin() + msg.start);
+        return msg;
+    }
+
+    void RPCPipeTransport::_write_batch(std::queue<_OutMessage>& pending)
+    {
+        std::vector<std::string> used;
+        used.reserve(pending.size());
+        while(! pending.empty())
+        {
+            _OutMessage& msg = pending.front();
+            _out.write(msg.buffer.data() + msg.start,msg.buffer.size() - msg.start);
+            used.push_back(std::move(msg.buffer));
+            pending.pop();
+        }
+        _out.flush();
+
+        std::lock_guard<std::mutex> lock(_tx_access);
+        for(std::string& buf : used)
+        {
+            if(_tx_pool.size() >= _tx_pool_size)
+                break;
+            buf.clear();
+            _tx_pool.push_back(std::move(buf));
+        }
+    }
+
     void RPCPipeTransport::_push_outbox(std::stop_token stok)
     {
-        using namespace std::chrono_literals;
-        bool remaining_data;
+        std::queue<_OutMessage> pending;
+        std::unique_lock lock(_tx_access);
         while (!stok.stop_requested())
         {
-            remaining_data = false;
+            _outbox_ready.wait(lock, stok, [this] { return !_outbox.empty(); });
+
+            // Take everything at once and release the lock while writing
+            // to avoid blocking the senders on the medium.
+            pending.swap(_outbox);
+            lock.unlock();
+            if(! pending.empty())
             {
-                std::lock_guard<std::mutex> lock(_tx_access);
-                if(! _outbox.empty())
-                {
-                    std::string to_out = _outbox.front().dump();
-                    to_out = fmt::format(
-                        "Content-Length: {}\r\n"
-                        "Content-Type: application/vscode-jsonrpc; charset=utf-8\r\n"
-                        "\r\n"
-                        "{}"
-                        ,to_out.length(),to_out);
-                    
-                    _out << to_out;
-
-                    if(_use_endl)
-                        _out << std::endl;
-
-                    _out.flush();
-
-                    _outbox.pop();
-                    remaining_data = _outbox.empty();
-                }
+                spdlog::trace("Writing {} pending message(s).",pending.size());
+                _write_batch(pending);
             }
-
-            std::this_thread::sleep_for(remaining_data ? 10ms : 100ms);
+            lock.lock();
         }
+
+        // Flush what remains (typically the reply to 'shutdown').
+        pending.swap(_outbox);
+        lock.unlock();
+        if(! pending.empty())
+            _write_batch(pending);
+
         spdlog::info("Stop polling outbox.");
     }
 
+    void RPCPipeTransport::set_priority_filter(std::function<bool(json&)> filter)
+    {
+        std::lock_guard<std::mutex> lock(_rx_access);
+        _priority_filter = std::move(filter);
+    }
+
     void RPCPipeTransport::abort()
     {
         spdlog::warn("Closing the RPC medium through 'abort' call.");
@@ -223,17 +334,22 @@ RPCPipeTransport::RPCPipeTransport(std::istream& input, std::ostream& output) :
         _data_available.notify_all();
     }
 
-    void RPCPipeTransport::send(const json& data)
+    void RPCPipeTransport::send(json&& data)
     {
-         
-        json to_send;
-        to_send["jsonrpc"] = "2.0";
-        to_send.update(data);
+        data["jsonrpc"] = "2.0";
+        _OutMessage msg = _frame(data);
 
         {
             std::lock_guard<std::mutex> lock(_tx_access);
-            _outbox.push(to_send);
+            _outbox.push(std::move(msg));
         }
+        _outbox_ready.notify_one();
+    }
+
+    void RPCPipeTransport::send(const json& data)
+    {
+        json to_send = data;
+        send(std::move(to_send));
     }
 
     json RPCPipeTransport::get()
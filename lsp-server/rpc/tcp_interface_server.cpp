@@ -1,5 +1,6 @@
 #include "tcp_interface_server.hpp"
 #include "spdlog/spdlog.h"
+#include <algorithm>
 
 namespace slsp {
     std::streamsize TCPInterfaceServer::xsputn(const TCPInterfaceServer::char_type *s, std::streamsize n)
@@ -46,6 +47,35 @@ namespace slsp {
         }
     }
 
+    /**
+     * Bulk reads are served from the already buffered data first, then
+     * directly from the socket into the destination to avoid going through #_rx
+     * byte by byte.
+     */
+    std::streamsize TCPInterfaceServer::xsgetn(TCPInterfaceServer::char_type *s, std::streamsize n)
+    {
+        std::streamsize done = std::min<std::streamsize>(n,egptr() - gptr());
+        if(done > 0)
+        {
+            traits_type::copy(s,gptr(),done);
+            gbump(static_cast<int>(done));
+        }
+
+        while(done < n)
+        {
+            int rd = _sock.read(s + done,n - done);
+            if(rd <= 0)
+            {
+                spdlog::debug("Got EOF during bulk read");
+                break;
+            }
+            done += rd;
+        }
+
+        spdlog::trace("Bulk read of {} bytes from TCP, {} requested.",done,n);
+        return done;
+    }
+
     TCPInterfaceServer::TCPInterfaceServer( in_port_t port, const std::string addr) :
         _listening_address(addr),
         _listening_port(port),